@@ -0,0 +1,117 @@
+/**
+ * @file AllocationExample.cpp
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include "BrilliantNetwork.h"
+#include "AllocationExample.h"
+
+namespace asio = boost::asio;
+
+//counts every heap allocation in the program, the example reads it around its echo loop
+static std::atomic<std::size_t> allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+//round trips before counting, so buffers and caches have settled
+static constexpr std::size_t warmup = 1000;
+
+//round trips counted
+static constexpr std::size_t messages = 10000;
+
+static asio::awaitable<void> ServerProc(Brilliant::Network::AwaitableConnection<Brilliant::Network::TcpProtocol>* conn)
+{
+    std::array<char, 64> buffer{};
+    while (true)
+    {
+        if (auto [size, ec] = co_await conn->ReadInto(asio::buffer(buffer)); ec)
+        {
+            break;
+        }
+
+        if (auto [size, ec] = co_await conn->Send(asio::buffer(buffer)); ec)
+        {
+            break;
+        }
+    }
+    conn->Disconnect();
+    co_return;
+}
+
+static asio::awaitable<void> Server()
+{
+    Brilliant::Network::AwaitableServer<Brilliant::Network::TcpProtocol> server(co_await asio::this_coro::executor);
+
+    auto accept = server.AcceptOn("8000");
+    auto c = co_await accept.async_resume(asio::use_awaitable);
+    auto conn = *c;
+    if (conn)
+    {
+        co_await ServerProc(conn);
+        server.Release(conn);
+    }
+    co_return;
+}
+
+static asio::awaitable<void> Client()
+{
+    Brilliant::Network::AwaitableClient<Brilliant::Network::TcpProtocol> client(co_await asio::this_coro::executor);
+    co_await client.Connect("localhost", "8000");
+
+    std::array<char, 64> buffer{};
+    std::size_t before = 0;
+    for (std::size_t i = 0; i < warmup + messages; ++i)
+    {
+        if (i == warmup)
+        {
+            before = allocations.load(std::memory_order_relaxed);
+        }
+
+        co_await client.Send(asio::buffer(buffer));
+        co_await client.Read(asio::buffer(buffer));
+    }
+    const auto counted = allocations.load(std::memory_order_relaxed) - before;
+
+    //both ends run on this thread, so each round trip is two sends and two reads
+    std::cout << "Allocations per round trip: " << static_cast<double>(counted) / messages << '\n';
+#ifndef BOOST_ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE
+    std::cout << "Define BOOST_ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE for every translation unit to let asio recycle every coroutine frame\n";
+#endif //BOOST_ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE
+    client.Disconnect();
+}
+
+void DoAllocationExample()
+{
+    std::cout << "Allocation Example\n";
+    asio::io_context context;
+    asio::co_spawn(context, Server(), asio::detached);
+    asio::co_spawn(context, Client(), asio::detached);
+    context.run();
+}
@@ -0,0 +1,177 @@
+/**
+ * @file CancellationExample.cpp
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ */
+
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "BrilliantNetwork.h"
+#include "CancellationExample.h"
+
+namespace asio = boost::asio;
+using namespace std::chrono_literals;
+
+/**
+ * @brief Listeners whose accept queue is full and never drained. The kernel then drops further SYNs, so
+ * connects to them hang until they are given up on, which makes the deadlines below the only way out
+ */
+struct Blackhole
+{
+    explicit Blackhole(asio::io_context& context) :
+        v4(context),
+        v6(context)
+    {
+        boost::system::error_code ec{};
+        v4.open(asio::ip::tcp::v4());
+        v4.bind({ asio::ip::address_v4::loopback(), 0 });
+        v4.listen(0);
+        port = v4.local_endpoint().port();
+
+        //without ipv6 localhost still resolves to 127.0.0.1
+        v6.open(asio::ip::tcp::v6(), ec);
+        if (!ec) { v6.set_option(asio::ip::v6_only{ true }, ec); }
+        if (!ec) { v6.bind({ asio::ip::address_v6::loopback(), port }, ec); }
+        if (!ec) { v6.listen(0, ec); }
+
+        for (auto* acceptor : { &v4, &v6 })
+        {
+            if (!acceptor->is_open()) { continue; }
+
+            for (int i = 0; i < 4; ++i)
+            {
+                auto& filler = fillers.emplace_back(context);
+                filler.async_connect(acceptor->local_endpoint(ec), [](boost::system::error_code) {});
+            }
+        }
+    }
+
+    asio::ip::tcp::acceptor v4;
+    asio::ip::tcp::acceptor v6;
+    std::vector<asio::ip::tcp::socket> fillers;
+    unsigned short port = 0;
+};
+
+/**
+ * @brief Print a check against the result expected
+ *
+ * @param name What was checked
+ * @param ec The error returned
+ * @param expected The error expected
+ * @param took How long the operation took
+ * @param limit How long it may take, to tell a deadline from the operating system giving up
+ * @return True if the check passed
+ */
+static bool Report(std::string_view name, boost::system::error_code ec, boost::system::error_code expected, std::chrono::steady_clock::duration took, std::chrono::steady_clock::duration limit)
+{
+    const bool ok = ec == expected && took < limit;
+    std::cout << (ok ? "ok     " : "FAILED ") << name << ": " << ec.message() << ", "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(took).count() << "ms\n";
+    return ok;
+}
+
+static asio::awaitable<bool> ConnectDeadline(unsigned short port)
+{
+    //races where localhost has an ipv6 and an ipv4 address, otherwise a single connect
+    Brilliant::Network::AwaitableClient<Brilliant::Network::TcpProtocol> client(co_await asio::this_coro::executor);
+    client.SetConnectOptions({ .race = true, .attempt_delay = 50ms });
+
+    const auto start = std::chrono::steady_clock::now();
+    auto ec = co_await client.Connect("localhost", std::to_string(port), 200ms);
+    co_return Report("connect deadline", ec, asio::error::timed_out, std::chrono::steady_clock::now() - start, 1s);
+}
+
+static asio::awaitable<bool> RaceAbandoned(unsigned short port)
+{
+    auto executor = co_await asio::this_coro::executor;
+
+    //two addresses so the race always runs, every attempt hangs and only cancellation ends it
+    const std::vector<asio::ip::tcp::endpoint> endpoints(2, asio::ip::tcp::endpoint{ asio::ip::address_v4::loopback(), port });
+    const auto results = asio::ip::tcp::resolver::results_type::create(endpoints.begin(), endpoints.end(), "blackhole", std::to_string(port));
+
+    asio::cancellation_signal signal;
+    asio::steady_timer deadline{ executor, 200ms };
+    deadline.async_wait([&signal](boost::system::error_code ec) {
+        if (!ec) { signal.emit(asio::cancellation_type::terminal); }
+    });
+
+    asio::ip::tcp::socket socket{ executor };
+    boost::system::error_code ec{};
+    const auto start = std::chrono::steady_clock::now();
+    co_await asio::co_spawn(executor, [&]() -> asio::awaitable<void> {
+        co_await asio::this_coro::throw_if_cancelled(false);
+        co_await Brilliant::Network::ConnectEndpoints(socket, results, { .race = true, .attempt_delay = 50ms }, ec);
+    }, asio::bind_cancellation_slot(signal.slot(), asio::use_awaitable));
+    co_return Report("connect race abandoned by cancellation", ec, asio::error::operation_aborted, std::chrono::steady_clock::now() - start, 1s);
+}
+
+static asio::awaitable<bool> ReadDeadline(unsigned short silent)
+{
+    Brilliant::Network::AwaitableClient<Brilliant::Network::TcpProtocol> client(co_await asio::this_coro::executor);
+    co_await client.Connect("127.0.0.1", std::to_string(silent));
+
+    std::array<char, 64> buffer{};
+    const auto start = std::chrono::steady_clock::now();
+    auto [_, ec] = co_await client.Read(asio::buffer(buffer), 200ms);
+    co_return Report("read deadline", ec, asio::error::timed_out, std::chrono::steady_clock::now() - start, 1s);
+}
+
+static asio::awaitable<bool> QueuedSendDeadline(unsigned short silent)
+{
+    Brilliant::Network::AwaitableClient<Brilliant::Network::TcpProtocol> client(co_await asio::this_coro::executor);
+    co_await client.Connect("127.0.0.1", std::to_string(silent));
+
+    //far more than the socket buffers hold, so the write blocks once they are full
+    const std::vector<char> big(64 * 1024 * 1024);
+    const auto start = std::chrono::steady_clock::now();
+    auto [_, ec] = co_await client.Send(asio::buffer(big), 200ms);
+    co_return Report("queued send deadline", ec, asio::error::timed_out, std::chrono::steady_clock::now() - start, 1s);
+}
+
+static asio::awaitable<bool> SendDeadline(unsigned short silent)
+{
+    Brilliant::Network::AwaitableClient<Brilliant::Network::HttpProtocol> client(co_await asio::this_coro::executor);
+    co_await client.Connect("127.0.0.1", std::to_string(silent));
+
+    //messages are not queued, the send is cancelled through a signal of its own
+    boost::beast::http::request<boost::beast::http::string_body> req(boost::beast::http::verb::post, "/", 11);
+    req.body().resize(64 * 1024 * 1024);
+    req.prepare_payload();
+    const auto start = std::chrono::steady_clock::now();
+    auto [_, ec] = co_await client.Send(req, 200ms);
+    co_return Report("send deadline", ec, asio::error::timed_out, std::chrono::steady_clock::now() - start, 1s);
+}
+
+static asio::awaitable<void> Client(unsigned short port, unsigned short silent, bool& passed)
+{
+    passed = co_await ConnectDeadline(port);
+    passed = co_await RaceAbandoned(port) && passed;
+    passed = co_await ReadDeadline(silent) && passed;
+    passed = co_await QueuedSendDeadline(silent) && passed;
+    passed = co_await SendDeadline(silent) && passed;
+}
+
+void DoCancellationExample()
+{
+    std::cout << "Cancellation Example\n";
+    asio::io_context context;
+    Blackhole blackhole{ context };
+
+    //connects complete in the backlog of a listener which never accepts, nothing is ever read or sent
+    asio::ip::tcp::acceptor silent{ context, { asio::ip::address_v4::loopback(), 0 } };
+
+    bool passed = false;
+    asio::co_spawn(context, Client(blackhole.port, silent.local_endpoint().port(), passed), [&](std::exception_ptr) {
+        context.stop();
+    });
+    context.run();
+    std::cout << (passed ? "Cancellation checks passed\n" : "Cancellation checks FAILED\n");
+}
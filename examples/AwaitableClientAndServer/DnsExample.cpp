@@ -0,0 +1,172 @@
+/**
+ * @file DnsExample.cpp
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ */
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "BrilliantNetwork.h"
+#include "DnsExample.h"
+
+namespace asio = boost::asio;
+using namespace std::chrono_literals;
+
+//the record types the resolver asks for
+static constexpr std::uint16_t type_a = 1;
+
+/**
+ * @brief Make the stub server's answer to a query. A records are 10.0.0.1 and AAAA records ::1, both with a
+ * 60 second ttl. Names containing "missing" do not exist, names containing "big" are truncated over udp
+ *
+ * @param query The query
+ * @param over_tcp True if the query came over tcp, which is never truncated
+ * @return The answer
+ */
+static std::vector<std::uint8_t> Answer(const std::vector<std::uint8_t>& query, bool over_tcp)
+{
+    const std::string_view question{ reinterpret_cast<const char*>(query.data()) + 12, query.size() - 12 };
+    const std::uint16_t type = static_cast<std::uint16_t>((query[query.size() - 4] << 8) | query[query.size() - 3]);
+
+    //response, recursion desired and available
+    std::vector<std::uint8_t> answer{ query };
+    answer[2] = 0x81;
+    answer[3] = 0x80;
+    if (question.find("missing") != std::string_view::npos)
+    {
+        answer[3] |= 0x03;
+        return answer;
+    }
+
+    if (!over_tcp && question.find("big") != std::string_view::npos)
+    {
+        answer[2] |= 0x02;
+        return answer;
+    }
+
+    //one answer, pointing back at the question's name
+    answer[7] = 1;
+    answer.insert(answer.end(), { 0xc0, 0x0c, 0, static_cast<std::uint8_t>(type), 0, 1, 0, 0, 0, 60 });
+    if (type == type_a)
+    {
+        answer.insert(answer.end(), { 0, 4, 10, 0, 0, 1 });
+    }
+    else
+    {
+        answer.insert(answer.end(), { 0, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 });
+    }
+    return answer;
+}
+
+static asio::awaitable<void> UdpStub(asio::ip::udp::socket& socket)
+{
+    std::array<std::uint8_t, 512> buffer{};
+    asio::ip::udp::endpoint from{};
+    boost::system::error_code ec{};
+    while (true)
+    {
+        const auto size = co_await socket.async_receive_from(asio::buffer(buffer), from, asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) { co_return; }
+
+        const auto answer = Answer({ buffer.begin(), buffer.begin() + size }, false);
+        co_await socket.async_send_to(asio::buffer(answer), from, asio::redirect_error(asio::use_awaitable, ec));
+    }
+}
+
+static asio::awaitable<void> TcpStub(asio::ip::tcp::acceptor& acceptor)
+{
+    boost::system::error_code ec{};
+    while (true)
+    {
+        auto socket = co_await acceptor.async_accept(asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) { co_return; }
+
+        //messages over tcp are prefixed with their size
+        std::array<std::uint8_t, 2> prefix{};
+        co_await asio::async_read(socket, asio::buffer(prefix), asio::redirect_error(asio::use_awaitable, ec));
+        std::vector<std::uint8_t> query(ec ? 0 : (prefix[0] << 8) | prefix[1]);
+        co_await asio::async_read(socket, asio::buffer(query), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) { continue; }
+
+        const auto answer = Answer(query, true);
+        prefix = { static_cast<std::uint8_t>(answer.size() >> 8), static_cast<std::uint8_t>(answer.size()) };
+        co_await asio::async_write(socket, std::array<asio::const_buffer, 2>{ asio::buffer(prefix), asio::buffer(answer) }, asio::redirect_error(asio::use_awaitable, ec));
+    }
+}
+
+/**
+ * @brief Resolve a host and print the result against what the stub server should have answered
+ *
+ * @param resolver The resolver
+ * @param host The host
+ * @param expected The expected error
+ * @param expected_count The expected number of endpoints
+ * @return True if the result was as expected
+ */
+static asio::awaitable<bool> Check(Brilliant::Network::DnsResolver& resolver, std::string_view host, boost::system::error_code expected, std::size_t expected_count)
+{
+    boost::system::error_code ec{};
+    std::chrono::steady_clock::duration ttl = std::chrono::hours(1);
+    const auto start = std::chrono::steady_clock::now();
+    auto results = co_await resolver.Resolve<asio::ip::tcp>(co_await asio::this_coro::executor, host, "443", ec, ttl);
+    const auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    const bool ok = ec == expected && results.size() == expected_count;
+    std::cout << (ok ? "ok     " : "FAILED ") << host << ": " << ec.message() << ", ttl " << std::chrono::duration_cast<std::chrono::seconds>(ttl).count()
+        << "s, " << took.count() << "ms:";
+    for (const auto& entry : results)
+    {
+        std::cout << ' ' << entry.endpoint().address();
+    }
+    std::cout << '\n';
+    co_return ok;
+}
+
+static asio::awaitable<void> Client(asio::ip::udp::endpoint stub, asio::ip::udp::endpoint silent, bool& passed)
+{
+    Brilliant::Network::DnsResolverOptions options{};
+    options.servers = { stub };
+    options.timeout = 200ms;
+    options.attempts = 1;
+    options.hosts["static.test"] = { asio::ip::make_address("192.0.2.7") };
+    Brilliant::Network::DnsResolver resolver{ options };
+
+    passed = co_await Check(resolver, "Example.test", {}, 2);
+    passed = co_await Check(resolver, "missing.test", asio::error::host_not_found, 0) && passed;
+    passed = co_await Check(resolver, "big.test", {}, 2) && passed;
+    passed = co_await Check(resolver, "static.test", {}, 1) && passed;
+
+    //the first server never answers, its timeout must not cancel the read from the second
+    options.servers = { silent, stub };
+    Brilliant::Network::DnsResolver failover{ options };
+    passed = co_await Check(failover, "failover.test", {}, 2) && passed;
+    passed = co_await Check(failover, "failover.test", {}, 2) && passed;
+}
+
+void DoDnsExample()
+{
+    std::cout << "Dns Example\n";
+    asio::io_context context;
+
+    //a stub name server on one port for udp and tcp, and a server which never answers
+    asio::ip::udp::socket stub{ context, { asio::ip::address_v4::loopback(), 0 } };
+    asio::ip::tcp::acceptor acceptor{ context, { asio::ip::address_v4::loopback(), stub.local_endpoint().port() } };
+    asio::ip::udp::socket silent{ context, { asio::ip::address_v4::loopback(), 0 } };
+    asio::co_spawn(context, UdpStub(stub), asio::detached);
+    asio::co_spawn(context, TcpStub(acceptor), asio::detached);
+
+    bool passed = false;
+    asio::co_spawn(context, Client(stub.local_endpoint(), silent.local_endpoint(), passed), [&](std::exception_ptr) {
+        stub.close();
+        acceptor.close();
+    });
+    context.run();
+    std::cout << (passed ? "Dns resolver checks passed\n" : "Dns resolver checks FAILED\n");
+}
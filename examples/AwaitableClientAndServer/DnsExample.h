@@ -0,0 +1,12 @@
+/**
+ * @file DnsExample.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ */
+
+#pragma once
+
+void DoDnsExample();
@@ -0,0 +1,97 @@
+/**
+ * @file FramedExample.cpp
+ * @author David Brill (6david6brill6@gmail.com)
+ * 
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ */
+
+#include <iostream>
+#include <iomanip>
+
+#include "BrilliantNetwork.h"
+#include "FramedExample.h"
+
+namespace asio = boost::asio;
+
+static asio::awaitable<void> ServerProc(Brilliant::Network::AwaitableConnection<Brilliant::Network::FramedTcpProtocol>* conn)
+{
+    //frames can be any size up to the limit, no need to know the message size up front
+    conn->GetProtocol().SetMaxFrameSize(4096);
+
+    std::vector<asio::const_buffer> frames;
+    bool done = false;
+    while (!done)
+    {
+        if (auto [count, ec] = co_await conn->ReadInto(frames); ec)
+        {
+            std::cout << "ERROR: " << ec.message() << '\n';
+            break;
+        }
+
+        //every complete frame received so far is returned at once
+        for (const auto& frame : frames)
+        {
+            std::string_view message{ static_cast<const char*>(frame.data()), frame.size() };
+            std::cout << "Server read: " << std::quoted(message) << '\n';
+
+            if (message == "bye server")
+            {
+                std::cout << "Server closing connection\n";
+                done = true;
+                break;
+            }
+
+            if (auto [size, ec] = co_await conn->Send(asio::buffer(std::string_view{ "hello client" })); ec)
+            {
+                std::cout << "ERROR: " << ec.message() << '\n';
+                done = true;
+                break;
+            }
+        }
+    }
+    conn->Disconnect();
+    co_return;
+}
+
+static asio::awaitable<void> Server()
+{
+    Brilliant::Network::AwaitableServer<Brilliant::Network::FramedTcpProtocol> server(co_await asio::this_coro::executor);
+
+    auto accept = server.AcceptOn("8000");
+    auto c = co_await accept.async_resume(asio::use_awaitable);
+    auto conn = *c;
+    if (conn)
+    {
+        co_await ServerProc(conn);
+        server.Release(conn);
+    }
+    co_return;
+}
+
+static asio::awaitable<void> Client()
+{
+    Brilliant::Network::AwaitableClient<Brilliant::Network::FramedTcpProtocol> client(co_await asio::this_coro::executor);
+    co_await client.Connect("localhost", "8000");
+    co_await client.Send(asio::buffer(std::string_view{ "hello server" }));
+
+    std::vector<asio::const_buffer> frames;
+    co_await client.Read(frames);
+    for (const auto& frame : frames)
+    {
+        std::cout << "Client received: " << std::quoted(std::string_view{ static_cast<const char*>(frame.data()), frame.size() }) << '\n';
+    }
+
+    co_await client.Send(asio::buffer(std::string_view{ "bye server" }));
+    client.Disconnect();
+}
+
+void DoFramedExample()
+{
+    std::cout << "Framed Example\n";
+    asio::io_context context;
+    asio::co_spawn(context, Server(), asio::detached);
+    asio::co_spawn(context, Client(), asio::detached);
+    context.run();
+}
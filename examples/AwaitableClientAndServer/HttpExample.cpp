@@ -17,6 +17,8 @@ namespace http = boost::beast::http;
 asio::awaitable<void> ServerProc(Brilliant::Network::AwaitableConnection<Brilliant::Network::HttpProtocol>* conn)
 {
     co_await conn->Connect();
+    //the read buffer is kept across requests, cap how much a client can make it hold
+    conn->GetProtocol().SetReadBufferLimit(64 * 1024);
     while(true)
     {
         http::request<http::string_body> req;
@@ -53,6 +55,7 @@ asio::awaitable<void> Server()
     auto c = co_await acceptor.async_resume(asio::use_awaitable);
     auto conn = *c;
     co_await ServerProc(conn);
+    server.Release(conn);
 }
 
 asio::awaitable<void> Client()
@@ -68,12 +68,14 @@ asio::awaitable<void> HttpsServer()
     auto c = co_await accept.async_resume(asio::use_awaitable);
     auto conn = *c;
     co_await ServerProc(conn);
+    server.Release(conn);
 }
 
 asio::awaitable<void> HttpsClient()
 {
     asio::ssl::context ssl(asio::ssl::context::tlsv12);
     ssl.load_verify_file("public.pem");
+    Brilliant::Network::SslSessionCache::Install(ssl);
 
     Brilliant::Network::AwaitableClient<Brilliant::Network::HttpsProtocol> client(co_await asio::this_coro::executor, ssl);
     if (auto ec = co_await client.Connect("localhost", "8000"); ec)
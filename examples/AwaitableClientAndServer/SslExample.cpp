@@ -9,7 +9,6 @@
 
 #include <iostream>
 #include <iomanip>
-#include <thread>
 
 #include "BrilliantNetwork.h"
 #include "SslExample.h"
@@ -53,7 +52,7 @@ static asio::awaitable<void> ServerProc(Brilliant::Network::AwaitableConnection<
 
         std::cout << "Server sent: " << std::quoted("hello client") << '\n';
     }
-    conn->Disconnect();
+    co_await conn->AsyncDisconnect();
     co_return;
 }
 
@@ -87,6 +86,7 @@ static asio::awaitable<void> Server()
             timer.cancel();
             //asio::co_spawn(co_await asio::this_coro::executor, ServerProc(conn), asio::detached);
             co_await ServerProc(conn);
+            server.Release(conn);
         }
     }
     co_return;
@@ -96,6 +96,7 @@ static asio::awaitable<void> Client()
 {
     asio::ssl::context ssl(asio::ssl::context::tlsv12);
     ssl.load_verify_file("public.pem");
+    Brilliant::Network::SslSessionCache::Install(ssl);
 
     Brilliant::Network::AwaitableClient<Brilliant::Network::SslProtocol> client(co_await asio::this_coro::executor, ssl);
     //Should we provide the underlying socket or at least a way to access it?
@@ -135,21 +136,18 @@ static asio::awaitable<void> Client()
 
     std::cout << "Client sent: \"bye server..\"\n";
 
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-
-    client.Disconnect();
+    //waits for the server's close_notify without blocking the thread
+    co_await client.AsyncDisconnect();
 }
 
 void DoSslExample()
 {
     std::cout << "Ssl Example\n";
-    //Unsure exactly why, but this doesn't work if we use the usual io_context as the ssl_stream.shutdown() call will hang
-    //I suspect that it's because of coros running on same thread
-    //In normal usage (ie, connecting to a remote peer on another machine) using io_context should be fine
-    asio::thread_pool context;
+    //AsyncDisconnect does not block waiting for the peer's close_notify, so client and server can share one thread
+    asio::io_context context;
 
     asio::co_spawn(context, Server(), asio::detached);
     asio::co_spawn(context, Client(), asio::detached);
     
-    context.join();
+    context.run();
 }
\ No newline at end of file
@@ -63,6 +63,7 @@ static asio::awaitable<void> Server()
         {
             //asio::co_spawn(co_await asio::this_coro::executor, ServerProc(conn), asio::detached);
             co_await ServerProc(conn);
+            server.Release(conn);
         }
     }
     co_return;
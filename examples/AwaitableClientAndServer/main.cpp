@@ -12,6 +12,10 @@
 #include "SslExample.h"
 #include "HttpExample.h"
 #include "HttpsExample.h"
+#include "FramedExample.h"
+#include "AllocationExample.h"
+#include "DnsExample.h"
+#include "CancellationExample.h"
 
 int main(int argc, char* argv[])
 {
@@ -20,4 +24,8 @@ int main(int argc, char* argv[])
     DoSslExample();
     DoHttpExample();
     DoHttpsExample();
+    DoFramedExample();
+    DoAllocationExample();
+    DoDnsExample();
+    DoCancellationExample();
 }
\ No newline at end of file
@@ -11,6 +11,11 @@
 
 #include "brilliant/AsioIncludes.h"
 #include "brilliant/AwaitableClient.h"
+#include "brilliant/AwaitableClientPool.h"
 #include "brilliant/AwaitableServer.h"
 #include "brilliant/BasicProtocol.h"
-#include "brilliant/BasicHttpProtocol.h"
\ No newline at end of file
+#include "brilliant/BasicHttpProtocol.h"
+#include "brilliant/DatagramServer.h"
+#include "brilliant/DnsResolver.h"
+#include "brilliant/FramedProtocol.h"
+#include "brilliant/SslTicketKeyManager.h"
\ No newline at end of file
@@ -11,7 +11,9 @@
 
 #pragma once
 
+#include <chrono>
 #include <ranges>
+#include <span>
 
 #include "AwaitableConnection.h"
 
@@ -77,6 +79,65 @@ namespace Brilliant
                 return connection.Connect(host, service);
             }
 
+            /**
+             * @brief Connect to an endpoint created using the given host and service, giving up after the timeout
+             * 
+             * @param host The host as a string
+             * @param service The service as a string
+             * @param timeout The deadline, zero for none
+             * @return An error_code containing a connection error if there was one, asio::error::timed_out if the deadline passed
+             */
+            auto Connect(std::string_view host, std::string_view service, std::chrono::steady_clock::duration timeout)
+            {
+                return connection.Connect(host, service, timeout);
+            }
+
+            /**
+             * @brief Connect to an endpoint created using the given host and service, completing through any
+             * asio completion token
+             * 
+             * @tparam CompletionToken The completion token type, ie a callback or asio::use_future
+             * @param host The host as a string, copied into the operation
+             * @param service The service as a string, copied into the operation
+             * @param token Completed as void(error_code) with a connection error if there was one
+             * @return As given by the completion token
+             */
+            template<asio::completion_token_for<void(error_code)> CompletionToken>
+            auto Connect(std::string_view host, std::string_view service, CompletionToken&& token)
+            {
+                return connection.Connect(host, service, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Set the deadlines used by Connect, Send and Read when not given one
+             * 
+             * @param options The default deadlines
+             */
+            void SetTimeouts(const TimeoutOptions& options)
+            {
+                connection.SetTimeouts(options);
+            }
+
+            /**
+             * @brief Set how Connect tries the resolved addresses, ie the delay between raced attempts
+             * 
+             * @param options The connect options
+             */
+            void SetConnectOptions(const ConnectOptions& options)
+            {
+                connection.SetConnectOptions(options);
+            }
+
+            /**
+             * @brief Set the cache tls sessions are resumed from. Only for ssl protocols
+             * 
+             * @param cache The cache, which must outlive the client, or null to disable resumption
+             */
+            void SetSessionCache(SslSessionCache* cache)
+            {
+                connection.SetSessionCache(cache);
+            }
+
             /**
              * @brief Disconnect the client
              * 
@@ -87,6 +148,18 @@ namespace Brilliant
                 return connection.Disconnect();
             }
 
+            /**
+             * @brief Disconnect the client without blocking the thread. Ssl clients finish the tls shutdown
+             * with the peer first, giving up after the timeout
+             * 
+             * @param timeout How long to wait for the peer's side of the tls shutdown
+             * @return An error_code containing the first error which occurred during disconnect if there was one
+             */
+            asio::awaitable<error_code> AsyncDisconnect(std::chrono::steady_clock::duration timeout = std::chrono::seconds(5))
+            {
+                return connection.AsyncDisconnect(timeout);
+            }
+
             /**
              * @brief Send data via the connection
              * 
@@ -100,6 +173,36 @@ namespace Brilliant
                 return connection.Send(std::forward<T>(msg));
             }
 
+            /**
+             * @brief Send data via the connection, giving up after the timeout
+             * 
+             * @tparam T The message type
+             * @param msg The message
+             * @param timeout The deadline, zero for none
+             * @return The number of bytes sent and an error_code containing any errors that occurred during sending,
+             * asio::error::timed_out if the deadline passed
+             */
+            template<class T>
+            auto Send(T&& msg, std::chrono::steady_clock::duration timeout)
+            {
+                return connection.Send(std::forward<T>(msg), timeout);
+            }
+
+            /**
+             * @brief Send data via the connection, completing through any asio completion token without a coroutine frame
+             * 
+             * @tparam T The message type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param msg The message. Must stay valid until the send completes
+             * @param token Completed as void(error_code, std::size_t) with any error that occurred during sending and the number of bytes sent
+             * @return As given by the completion token
+             */
+            template<class T, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto Send(const T& msg, CompletionToken&& token)
+            {
+                return connection.Send(msg, std::forward<CompletionToken>(token));
+            }
+
             /**
              * @brief Read data into a message
              * 
@@ -113,6 +216,113 @@ namespace Brilliant
                 return connection.ReadInto(std::forward<T>(msg));
             }
 
+            /**
+             * @brief Read data into a message, giving up after the timeout
+             * 
+             * @tparam T The message type
+             * @param msg The message
+             * @param timeout The deadline, zero for none
+             * @return The number of bytes read and an error_code containing any errors that occurred during reading,
+             * asio::error::timed_out if the deadline passed
+             */
+            template<class T>
+            auto Read(T&& msg, std::chrono::steady_clock::duration timeout)
+            {
+                return connection.ReadInto(std::forward<T>(msg), timeout);
+            }
+
+            /**
+             * @brief Read data into a message, completing through any asio completion token without a coroutine frame
+             * 
+             * @tparam T The message type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param msg The message. Must stay valid until the read completes
+             * @param token Completed as void(error_code, std::size_t) with any error that occurred during reading and the number of bytes read
+             * @return As given by the completion token
+             */
+            template<class T, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto Read(T&& msg, CompletionToken&& token)
+            {
+                return connection.ReadInto(std::forward<T>(msg), std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Receive all available datagrams, up to one per buffer
+             * 
+             * @param buffers One buffer per datagram. Each buffer is shrunk to the size of the datagram received into it
+             * @return The number of datagrams received and the first error to occur if there was one 
+             */
+            auto ReadBatch(std::span<asio::mutable_buffer> buffers)
+            {
+                return connection.ReadBatch(buffers);
+            }
+
+            /**
+             * @brief Send a batch of datagrams
+             * 
+             * @param buffers One buffer per datagram
+             * @return The number of datagrams sent and the first error to occur if there was one 
+             */
+            auto SendBatch(std::span<const asio::const_buffer> buffers)
+            {
+                return connection.SendBatch(buffers);
+            }
+
+            /**
+             * @brief Send data as a run of equal sized datagrams, using udp segmentation offload where available
+             * 
+             * @param data The data to send
+             * @param segment_size The datagram payload size, the last datagram may be shorter
+             * @return The number of bytes written and the first error to occur if there was one 
+             */
+            template<class T>
+            auto SendSegments(const T& data, std::size_t segment_size)
+            {
+                return connection.SendSegments(data, segment_size);
+            }
+
+            /**
+             * @brief Read a datagram, or a run of datagrams coalesced by udp receive offload where available
+             * 
+             * @param data The buffer to read into
+             * @param[out] segment_size The size of each datagram in data, the last may be shorter
+             * @return The number of bytes read and the first error to occur if there was one 
+             */
+            auto ReadSegments(asio::mutable_buffer data, std::size_t& segment_size)
+            {
+                return connection.ReadSegments(data, segment_size);
+            }
+
+            /**
+             * @brief Read whatever is available into the connection's read buffer
+             * 
+             * @return A view of all unconsumed bytes and the first error to occur if there was one 
+             */
+            auto ReadSome()
+            {
+                return connection.ReadSome();
+            }
+
+            /**
+             * @brief Discard bytes returned by ReadSome once they have been processed
+             * 
+             * @param n The number of bytes to discard
+             */
+            void Consume(std::size_t n)
+            {
+                connection.Consume(n);
+            }
+
+            /**
+             * @brief Get the protocol implementation of the connection, allowing protocol settings
+             * 
+             * @return The protocol implementation
+             */
+            protocol_type& GetProtocol()
+            {
+                return connection.GetProtocol();
+            }
+
         private:
             //!The connection
             connection_type connection;
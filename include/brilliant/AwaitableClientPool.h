@@ -0,0 +1,634 @@
+/**
+ * @file AwaitableClientPool.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the AwaitableClientPool class template, which keeps client
+ * connections by host and service and leases them out for reuse
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "AwaitableConnection.h"
+#include "ConnectionPool.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @struct ClientPoolOptions
+         * @brief Limits and timing for an AwaitableClientPool, applied per host and service
+         */
+        template<class Connection>
+        struct ClientPoolOptions
+        {
+            //! Idle connections kept open past the idle timeout, and the number Prewarm connects
+            std::size_t min_idle = 0;
+
+            //! The most idle connections kept, more are closed when returned
+            std::size_t max_idle = 8;
+
+            //! The most connections open at once, leased and idle. Acquire waits for a return when
+            //! the limit is reached. Zero means no limit
+            std::size_t max_connections = 0;
+
+            //! Idle connections are closed after this long. Zero keeps them until they fail a health check
+            std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(60);
+
+            //! Checked on an idle connection before it is leased, after it passes IsAlive. Unhealthy connections are closed
+            std::function<bool(Connection&)> health_check;
+        };
+
+        /**
+         * @class AwaitableClientPool
+         * @brief Keeps connections by host and service and leases them to callers, so requests reuse
+         * an open connection instead of paying for a new connect and handshake. A leased connection goes
+         * back to the pool when its lease is destroyed. The pool must be used from the executor it was
+         * constructed with and must outlive its leases
+         * @tparam Protocol The protocol implementation type, ie TcpProtocol, SslProtocol or HttpProtocol
+         */
+        template<class Protocol>
+        class AwaitableClientPool
+        {
+        public:
+            using protocol_type = Protocol;
+            using socket_type = typename protocol_type::socket_type;
+            using connection_type = AwaitableConnection<protocol_type>;
+            using options_type = ClientPoolOptions<connection_type>;
+
+        private:
+            /**
+             * @struct Waiter
+             * @brief A caller waiting for a connection to a host and service, owned by the coroutine frame
+             * of the Acquire call that made it. Queues itself on construction and leaves the queue when destroyed
+             */
+            struct Waiter
+            {
+                Waiter(const asio::any_io_executor& exec, std::deque<Waiter*>& queue) :
+                    timer(exec, asio::steady_timer::time_point::max()),
+                    queue(&queue)
+                {
+                    queue.push_back(this);
+                }
+
+                Waiter(const Waiter&) = delete;
+                Waiter& operator=(const Waiter&) = delete;
+
+                /**
+                 * @brief Leave the queue. A wakeup received but not acted on goes to the next waiter, so a
+                 * cancelled caller does not strand one waiting behind it
+                 */
+                ~Waiter()
+                {
+                    if (queue)
+                    {
+                        queue->erase(std::find(queue->begin(), queue->end(), this));
+                        if (woken && !used)
+                        {
+                            WakeOne(*queue);
+                        }
+                    }
+                }
+
+                /**
+                 * @brief Wake the longest waiting caller not yet woken, if any. Woken callers stay queued until
+                 * they run, so the destructor can still reach them
+                 *
+                 * @param queue The waiters
+                 */
+                static void WakeOne(std::deque<Waiter*>& queue)
+                {
+                    auto it = std::find_if(queue.begin(), queue.end(), [](const Waiter* waiter) { return !waiter->woken; });
+                    if (it != queue.end())
+                    {
+                        (*it)->woken = true;
+                        (*it)->timer.cancel();
+                    }
+                }
+
+                //! Wakes the waiter, used as a condition variable
+                asio::steady_timer timer;
+
+                //! The queue the waiter is on, null once the pool is destroyed
+                std::deque<Waiter*>* queue;
+
+                //! Set once a connection may be available
+                bool woken = false;
+
+                //! Set once the caller has acted on its wakeup
+                bool used = false;
+
+                //! Set if the pool was destroyed while the waiter waited
+                bool closed = false;
+            };
+
+            /**
+             * @struct Bucket
+             * @brief The connections to one host and service
+             */
+            struct Bucket
+            {
+                //! The host
+                std::string host;
+
+                //! The service
+                std::string service;
+
+                //! Idle connections with the time they were returned, most recently returned last
+                std::vector<std::pair<connection_type*, std::chrono::steady_clock::time_point>> idle;
+
+                //! The number of connections open, leased and idle, or being connected
+                std::size_t open = 0;
+
+                //! Callers waiting for a connection, in the order they started waiting
+                std::deque<Waiter*> waiters;
+            };
+
+            /**
+             * @struct State
+             * @brief The pool's connections and buckets, shared with the idle sweep so a sweep completion
+             * already queued when the pool is destroyed finds them still alive
+             */
+            struct State
+            {
+                explicit State(const asio::any_io_executor& exec) :
+                    sweep_timer(exec)
+                {
+
+                }
+
+                //! Wakes the idle sweep
+                asio::steady_timer sweep_timer;
+
+                //! Connection storage. Addresses are stable until released
+                ConnectionPool<connection_type> connections;
+
+                //! Connections by host and service. Node based so bucket addresses are stable
+                std::unordered_map<std::string, Bucket> buckets;
+
+                //! Set on the executor once the pool is destroyed, ends the idle sweep
+                bool closed = false;
+            };
+
+        public:
+            /**
+             * @class Lease
+             * @brief A connection leased from the pool. Returns the connection to the pool when destroyed,
+             * or closes it if it is no longer connected
+             */
+            class Lease
+            {
+            public:
+                Lease() = default;
+
+                Lease(Lease&& other) noexcept :
+                    pool(std::exchange(other.pool, nullptr)),
+                    bucket(std::exchange(other.bucket, nullptr)),
+                    connection(std::exchange(other.connection, nullptr))
+                {
+
+                }
+
+                Lease& operator=(Lease&& other) noexcept
+                {
+                    if (this != &other)
+                    {
+                        Return();
+                        pool = std::exchange(other.pool, nullptr);
+                        bucket = std::exchange(other.bucket, nullptr);
+                        connection = std::exchange(other.connection, nullptr);
+                    }
+                    return *this;
+                }
+
+                ~Lease()
+                {
+                    Return();
+                }
+
+                /**
+                 * @brief Return the connection to the pool for reuse. Closes it instead if it is not connected
+                 *
+                 */
+                void Return()
+                {
+                    if (connection)
+                    {
+                        pool->Return(*bucket, connection, connection->IsConnected());
+                        connection = nullptr;
+                    }
+                }
+
+                /**
+                 * @brief Close the connection rather than returning it, ie after a protocol error
+                 *
+                 */
+                void Discard()
+                {
+                    if (connection)
+                    {
+                        pool->Return(*bucket, connection, false);
+                        connection = nullptr;
+                    }
+                }
+
+                connection_type* operator->() const
+                {
+                    return connection;
+                }
+
+                connection_type& operator*() const
+                {
+                    return *connection;
+                }
+
+                explicit operator bool() const
+                {
+                    return connection != nullptr;
+                }
+
+            private:
+                friend AwaitableClientPool;
+
+                Lease(AwaitableClientPool* pool, Bucket* bucket, connection_type* connection) :
+                    pool(pool),
+                    bucket(bucket),
+                    connection(connection)
+                {
+
+                }
+
+                //! The pool the connection goes back to
+                AwaitableClientPool* pool = nullptr;
+
+                //! The host and service of the connection
+                Bucket* bucket = nullptr;
+
+                //! The leased connection
+                connection_type* connection = nullptr;
+            };
+
+            /**
+             * @brief Construct a new Awaitable Client Pool object
+             *
+             * @param executor The asio executor for connections
+             * @param options Limits and timing
+             */
+            AwaitableClientPool(asio::any_io_executor executor, options_type options = {}) :
+                executor(executor),
+                options(std::move(options)),
+                state(std::make_shared<State>(executor))
+            {
+
+            }
+
+            /**
+             * @brief Construct a new Awaitable Client Pool object for ssl wrapped connections
+             *
+             * @param executor The asio executor for connections
+             * @param ssl The asio ssl context for connections
+             * @param options Limits and timing
+             */
+            AwaitableClientPool(asio::any_io_executor executor, asio::ssl::context& ssl, options_type options = {}) :
+                executor(executor),
+                ssl(&ssl),
+                options(std::move(options)),
+                state(std::make_shared<State>(executor))
+            {
+
+            }
+
+            AwaitableClientPool(const AwaitableClientPool&) = delete;
+            AwaitableClientPool& operator=(const AwaitableClientPool&) = delete;
+
+            /**
+             * @brief Destroy the Awaitable Client Pool object, closing all idle connections. The timers and
+             * connections belong to the pool's executor, which may be running on another thread, so the shared
+             * state is handed to it and closed there. Callers still waiting in Acquire return asio::error::operation_aborted
+             *
+             */
+            ~AwaitableClientPool()
+            {
+                asio::dispatch(executor, [state = std::move(state)]() {
+                    state->closed = true;
+                    state->sweep_timer.cancel();
+                    for (auto& [key, bucket] : state->buckets)
+                    {
+                        for (auto* waiter : bucket.waiters)
+                        {
+                            waiter->closed = true;
+                            waiter->queue = nullptr;
+                            waiter->timer.cancel();
+                        }
+                    }
+                    state->connections.ForEach([](connection_type& connection) {
+                        connection.Disconnect();
+                    });
+                });
+            }
+
+            /**
+             * @brief Lease a connection to the host and service. Reuses the most recently returned idle
+             * connection which passes the health checks, otherwise connects a new one
+             *
+             * @param host The host as a string
+             * @param service The service as a string
+             * @return The lease, empty if an error occurred, and the first error to occur if there was one.
+             * asio::error::operation_aborted if the wait for a connection was cancelled or the pool destroyed
+             */
+            asio::awaitable<std::pair<Lease, error_code>> Acquire(std::string_view host, std::string_view service)
+            {
+                auto& bucket = GetBucket(host, service);
+                StartSweep();
+
+                error_code ec{};
+                while (true)
+                {
+                    while (!bucket.idle.empty())
+                    {
+                        auto* connection = bucket.idle.back().first;
+                        bucket.idle.pop_back();
+                        if (IsHealthy(*connection))
+                        {
+                            co_return std::make_pair(Lease{ this, &bucket, connection }, error_code{});
+                        }
+                        Close(*state, bucket, connection);
+                    }
+
+                    if (options.max_connections == 0 || bucket.open < options.max_connections)
+                    {
+                        break;
+                    }
+
+                    //woken by Return and Close, each wakes the longest waiting caller not yet woken
+                    Waiter waiter{ executor, bucket.waiters };
+                    while (!waiter.woken)
+                    {
+                        co_await waiter.timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                        if (waiter.closed)
+                        {
+                            co_return std::make_pair(Lease{}, error_code{ asio::error::operation_aborted });
+                        }
+                        if (ec && !waiter.woken)
+                        {
+                            //cancelled while still waiting, the next wakeup goes to the caller behind
+                            co_return std::make_pair(Lease{}, ec);
+                        }
+                    }
+                    waiter.used = true;
+                }
+
+                auto* connection = co_await Connect(bucket, ec);
+                if (ec)
+                {
+                    co_return std::make_pair(Lease{}, ec);
+                }
+                co_return std::make_pair(Lease{ this, &bucket, connection }, error_code{});
+            }
+
+            /**
+             * @brief Connect idle connections to the host and service until min_idle are open
+             *
+             * @param host The host as a string
+             * @param service The service as a string
+             * @return The first error to occur if there was one
+             */
+            asio::awaitable<error_code> Prewarm(std::string_view host, std::string_view service)
+            {
+                auto& bucket = GetBucket(host, service);
+                StartSweep();
+
+                error_code ec{};
+                while (bucket.idle.size() < options.min_idle && (options.max_connections == 0 || bucket.open < options.max_connections))
+                {
+                    auto* connection = co_await Connect(bucket, ec);
+                    if (ec) { break; }
+
+                    bucket.idle.emplace_back(connection, std::chrono::steady_clock::now());
+                }
+                co_return ec;
+            }
+
+            /**
+             * @brief Get the number of idle connections to a host and service
+             *
+             * @param host The host as a string
+             * @param service The service as a string
+             * @return The number of idle connections
+             */
+            std::size_t IdleCount(std::string_view host, std::string_view service) const
+            {
+                auto it = state->buckets.find(MakeKey(host, service));
+                return it == state->buckets.end() ? 0 : it->second.idle.size();
+            }
+
+            /**
+             * @brief Get the number of open connections to a host and service, leased and idle
+             *
+             * @param host The host as a string
+             * @param service The service as a string
+             * @return The number of open connections
+             */
+            std::size_t OpenCount(std::string_view host, std::string_view service) const
+            {
+                auto it = state->buckets.find(MakeKey(host, service));
+                return it == state->buckets.end() ? 0 : it->second.open;
+            }
+
+            /**
+             * @brief Get the executor object
+             *
+             * @return The executor
+             */
+            auto get_executor()
+            {
+                return executor;
+            }
+
+        private:
+            /**
+             * @brief Get the bucket of a host and service, creating it if needed
+             *
+             * @param host The host
+             * @param service The service
+             * @return The bucket, its address is stable for the life of the pool
+             */
+            Bucket& GetBucket(std::string_view host, std::string_view service)
+            {
+                auto [it, inserted] = state->buckets.try_emplace(MakeKey(host, service));
+                if (inserted)
+                {
+                    it->second.host = host;
+                    it->second.service = service;
+                }
+                return it->second;
+            }
+
+            /**
+             * @brief Connect a new connection to the bucket's host and service
+             *
+             * @param bucket The bucket
+             * @param[out] ec Set if the connect failed
+             * @return The connection, nullptr if the connect failed
+             */
+            asio::awaitable<connection_type*> Connect(Bucket& bucket, error_code& ec)
+            {
+                ++bucket.open;
+                connection_type* connection = nullptr;
+                if constexpr (is_ssl_wrapped_v<socket_type>)
+                {
+                    connection = state->connections.Acquire(socket_type{ executor, *ssl });
+                }
+                else
+                {
+                    connection = state->connections.Acquire(socket_type{ executor });
+                }
+
+                ec = co_await connection->Connect(bucket.host, bucket.service);
+                if (ec)
+                {
+                    Close(*state, bucket, connection);
+                    co_return nullptr;
+                }
+                co_return connection;
+            }
+
+            /**
+             * @brief Take a connection back from a lease
+             *
+             * @param bucket The bucket of the connection
+             * @param connection The connection
+             * @param reuse False to close the connection
+             */
+            void Return(Bucket& bucket, connection_type* connection, bool reuse)
+            {
+                if (reuse && bucket.idle.size() < options.max_idle)
+                {
+                    bucket.idle.emplace_back(connection, std::chrono::steady_clock::now());
+                    Waiter::WakeOne(bucket.waiters);
+                    return;
+                }
+                Close(*state, bucket, connection);
+            }
+
+            /**
+             * @brief Disconnect a connection and free its storage
+             *
+             * @param state The pool's state
+             * @param bucket The bucket of the connection
+             * @param connection The connection
+             */
+            static void Close(State& state, Bucket& bucket, connection_type* connection)
+            {
+                connection->Disconnect();
+                state.connections.Release(connection);
+                --bucket.open;
+                Waiter::WakeOne(bucket.waiters);
+            }
+
+            /**
+             * @brief Tells if an idle connection can be leased
+             *
+             * @param connection The connection
+             * @return True if the connection passes IsAlive and the configured health check
+             */
+            bool IsHealthy(connection_type& connection)
+            {
+                return connection.IsAlive() && (!options.health_check || options.health_check(connection));
+            }
+
+            /**
+             * @brief Start closing expired idle connections if that is not already running
+             *
+             */
+            void StartSweep()
+            {
+                if (sweeping || options.idle_timeout.count() <= 0) { return; }
+
+                sweeping = true;
+                asio::co_spawn(executor, Sweep(state, options.idle_timeout, options.min_idle), asio::detached);
+            }
+
+            /**
+             * @brief Close idle connections which have been idle for the idle timeout, keeping min_idle per
+             * host and service. Oldest connections are closed first. Holds the state rather than the pool,
+             * so it can end safely after the pool is destroyed
+             *
+             * @param state The pool's state
+             * @param idle_timeout How long a connection may stay idle
+             * @param min_idle Idle connections kept per host and service
+             */
+            static asio::awaitable<void> Sweep(std::shared_ptr<State> state, std::chrono::steady_clock::duration idle_timeout, std::size_t min_idle)
+            {
+                error_code ec{};
+                while (true)
+                {
+                    state->sweep_timer.expires_after(std::max<std::chrono::steady_clock::duration>(idle_timeout / 2, std::chrono::milliseconds(1)));
+                    co_await state->sweep_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                    if (ec || state->closed) { co_return; }
+
+                    const auto now = std::chrono::steady_clock::now();
+                    for (auto& [key, bucket] : state->buckets)
+                    {
+                        std::size_t expired = 0;
+                        while (expired < bucket.idle.size() && bucket.idle.size() - expired > min_idle &&
+                            now - bucket.idle[expired].second >= idle_timeout)
+                        {
+                            ++expired;
+                        }
+
+                        for (std::size_t i = 0; i < expired; ++i)
+                        {
+                            Close(*state, bucket, bucket.idle[i].first);
+                        }
+                        bucket.idle.erase(bucket.idle.begin(), bucket.idle.begin() + expired);
+                    }
+                }
+            }
+
+            /**
+             * @brief Make the key of a host and service
+             *
+             * @param host The host
+             * @param service The service
+             * @return The key
+             */
+            static std::string MakeKey(std::string_view host, std::string_view service)
+            {
+                std::string key{ host };
+                key.push_back(':');
+                key.append(service);
+                return key;
+            }
+
+            //! The asio executor for connections
+            asio::any_io_executor executor;
+
+            //! The ssl context for ssl wrapped connections
+            asio::ssl::context* ssl = nullptr;
+
+            //! Limits and timing
+            options_type options;
+
+            //! Connections, buckets and the sweep timer. Shared so the destructor can hand them to the executor
+            std::shared_ptr<State> state;
+
+            //! Set once the idle sweep is running
+            bool sweeping = false;
+        };
+    }
+}
@@ -11,11 +11,27 @@
 
 #pragma once
 
+#include <cerrno>
+#include <chrono>
 #include <concepts>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "AsioIncludes.h"
 #include "SocketTraits.h"
+#include "Deadline.h"
 #include "EndpointHelper.h"
+#include "HandshakePool.h"
+#include "IdleReaper.h"
+#include "SendQueue.h"
+#include "SocketOptions.h"
+#include "SslSessionCache.h"
 
 namespace Brilliant
 {
@@ -23,7 +39,9 @@ namespace Brilliant
     {
         /**
          * @class AwaitableConnection
-         * @brief Provides an interface for connections on the given protocol
+         * @brief Provides an interface for connections on the given protocol. Deadlines cancel an operation
+         * from the executor of the coroutine awaiting it. When a context is run by more than one thread, make
+         * the socket on a strand, ie asio::make_strand(context), and run the connection's coroutines on it
          * @tparam Protocol The protocol implementation type
          */
         template<class Protocol>
@@ -39,19 +57,37 @@ namespace Brilliant
              * @param sock The socket to connect on
              */
             AwaitableConnection(socket_type sock) : 
-                socket(std::move(sock))
+                socket(std::move(sock)),
+                connect_deadline(socket.get_executor()),
+                read_deadline(socket.get_executor())
             {
 
             }
 
             /**
-             * @brief Connect using the socket
+             * @brief Connect using the socket, ie the server side tls handshake of an accepted connection
              * 
              * @return The first error that occurred during connection if there was one
              */
             asio::awaitable<error_code> Connect()
             {
-                return impl.Connect(socket);
+                return Connect(timeouts.handshake);
+            }
+
+            /**
+             * @brief Connect using the socket, closing it if that takes longer than the timeout
+             * 
+             * @param timeout The deadline, zero for none
+             * @return The first error that occurred during connection if there was one, asio::error::timed_out if the deadline passed
+             */
+            asio::awaitable<error_code> Connect(std::chrono::steady_clock::duration timeout)
+            {
+                //a pooled handshake goes through ConnectBefore even without a deadline, so Disconnect can cancel it
+                if (timeout.count() <= 0 && !IsHandshakePooled())
+                {
+                    return impl.Connect(socket);
+                }
+                return ConnectBefore(timeout);
             }
 
             /**
@@ -63,21 +99,179 @@ namespace Brilliant
              */
             asio::awaitable<error_code> Connect(std::string_view host, std::string_view service)
             {
-                auto result = co_await impl.Connect(socket, host, service);
+                return Connect(host, service, timeouts.connect);
+            }
+
+            /**
+             * @brief Connect to the endpoint via the host and service, closing the socket if that takes longer
+             * than the timeout. Resolving is not interrupted, a deadline passed while resolving is reported once
+             * it finishes
+             * 
+             * @param host The host to connect to 
+             * @param service The service to connect to
+             * @param timeout The deadline, zero for none
+             * @return The first error that occurred during connection if there was one, asio::error::timed_out if the deadline passed
+             */
+            asio::awaitable<error_code> Connect(std::string_view host, std::string_view service, std::chrono::steady_clock::duration timeout)
+            {
+                std::pair<typename protocol_type::endpoint_type, error_code> result{};
+                if (timeout.count() <= 0)
+                {
+                    result = co_await impl.Connect(socket, host, service);
+                }
+                else
+                {
+                    //the signal abandons a happy eyeballs race, closing the socket aborts a plain connect or the handshake
+                    connect_deadline.Start(timeout, co_await asio::this_coro::executor, [this] {
+                        connect_signal.emit(asio::cancellation_type::terminal);
+                        CloseLowest();
+                    });
+                    result = co_await asio::co_spawn(socket.get_executor(), Cancellable(impl.Connect(socket, host, service)),
+                        asio::bind_cancellation_slot(connect_signal.slot(), asio::use_awaitable));
+                    connect_deadline.Stop();
+                }
+
+                if (connect_deadline.Expired())
+                {
+                    impl.Disconnect(socket);
+                    std::get<error_code>(result) = asio::error::timed_out;
+                }
+
                 remote_endpoint = std::get<typename protocol_type::endpoint_type>(result);
+                connected = !std::get<error_code>(result);
                 co_return std::get<error_code>(result);
             }
 
             /**
-             * @brief Disconnect and close the underlying socket
+             * @brief Connect using the socket, completing through any asio completion token. Runs the
+             * awaitable Connect() with asio::co_spawn once the operation starts
+             * 
+             * @tparam CompletionToken The completion token type, ie a callback or asio::use_future
+             * @param token Completed as void(error_code) with the first error that occurred during connection
+             * @return As given by the completion token
+             */
+            template<asio::completion_token_for<void(error_code)> CompletionToken>
+            auto Connect(CompletionToken&& token)
+            {
+                return asio::async_initiate<CompletionToken, void(error_code)>([this](auto handler) {
+                    SpawnConnect(Connect(), std::move(handler));
+                }, token);
+            }
+
+            /**
+             * @brief Connect to the endpoint via the host and service, completing through any asio completion
+             * token. Runs the awaitable Connect(host, service) with asio::co_spawn once the operation starts
+             * 
+             * @tparam CompletionToken The completion token type, ie a callback or asio::use_future
+             * @param host The host to connect to, copied into the operation
+             * @param service The service to connect to, copied into the operation
+             * @param token Completed as void(error_code) with the first error that occurred during connection
+             * @return As given by the completion token
+             */
+            template<asio::completion_token_for<void(error_code)> CompletionToken>
+            auto Connect(std::string_view host, std::string_view service, CompletionToken&& token)
+            {
+                return asio::async_initiate<CompletionToken, void(error_code)>([this](auto handler, std::string host, std::string service) {
+                    SpawnConnect(ConnectTo(std::move(host), std::move(service)), std::move(handler));
+                }, token, std::string{ host }, std::string{ service });
+            }
+
+            /**
+             * @brief Set the deadlines used by Connect, Send and ReadInto when not given one
+             * 
+             * @param options The default deadlines
+             */
+            void SetTimeouts(const TimeoutOptions& options)
+            {
+                timeouts = options;
+            }
+
+            /**
+             * @brief Get the deadlines used by Connect, Send and ReadInto when not given one
+             * 
+             * @return The default deadlines
+             */
+            const TimeoutOptions& GetTimeouts() const
+            {
+                return timeouts;
+            }
+
+            /**
+             * @brief Set how Connect(host, service) tries the resolved addresses
+             * 
+             * @param options The connect options
+             */
+            void SetConnectOptions(const ConnectOptions& options)
+            {
+                impl.SetConnectOptions(options);
+            }
+
+            /**
+             * @brief Set the cache tls sessions are resumed from. Only for ssl protocols
+             * 
+             * @param cache The cache, which must outlive the connection, or null to disable resumption
+             */
+            void SetSessionCache(SslSessionCache* cache)
+            {
+                impl.SetSessionCache(cache);
+            }
+
+            /**
+             * @brief Set the pool the server handshake in Connect() runs on. Only for ssl protocols
+             * 
+             * @param pool The pool, which must outlive the connection, or null to handshake on the connection's executor
+             */
+            void SetHandshakePool(HandshakePool* pool)
+            {
+                impl.SetHandshakePool(pool);
+            }
+
+            /**
+             * @brief Disconnect and close the underlying socket. During a handshake on a HandshakePool
+             * the handshake is cancelled instead, and the socket closed once it ends
              * 
              * @return The first error that occurred during disconnection if there was one
              */
             error_code Disconnect()
             {
+                connected = false;
+                if (DeferClose()) { return error_code{}; }
+
                 return impl.Disconnect(socket);
             }
 
+            /**
+             * @brief Close the lowest layer of the socket at once, aborting its operations. Skips the tls
+             * shutdown, so it never blocks, ie for reaping idle connections
+             * 
+             */
+            void Close()
+            {
+                connected = false;
+                if (DeferClose()) { return; }
+
+                error_code ec{};
+                auto& lowest = GetLowestSocket(socket);
+                lowest.cancel(ec);
+                lowest.close(ec);
+            }
+
+            /**
+             * @brief Disconnect and close the underlying socket without blocking the thread. Ssl connections
+             * finish the tls shutdown with the peer first, giving up after the timeout. During a handshake on a
+             * HandshakePool the handshake is cancelled instead, and the socket closed once it ends
+             * 
+             * @param timeout How long to wait for the peer's side of the tls shutdown
+             * @return The first error that occurred during disconnection if there was one. The socket is closed either way
+             */
+            asio::awaitable<error_code> AsyncDisconnect(std::chrono::steady_clock::duration timeout = std::chrono::seconds(5))
+            {
+                connected = false;
+                if (DeferClose()) { co_return error_code{}; }
+
+                co_return co_await impl.AsyncDisconnect(socket, timeout);
+            }
+
             /**
              * @brief Tells if the connection is active
              * 
@@ -89,7 +283,51 @@ namespace Brilliant
             }
 
             /**
-             * @brief Send data on the socket
+             * @brief Tells if the connection is open and the peer has not closed it. Peeks at the
+             * socket without blocking, so it is cheap enough to call before reusing an idle connection
+             * 
+             * @return True if the connection can still be used
+             */
+            bool IsAlive()
+            {
+                if (!IsConnected()) { return false; }
+
+                error_code ec{};
+                auto& lowest = GetLowestSocket(socket);
+                const bool was_non_blocking = lowest.non_blocking();
+                lowest.non_blocking(true, ec);
+                if (ec) { return false; }
+
+                //a closed stream reads eof, an idle one would block
+                char byte{};
+                const auto result = ::recv(lowest.native_handle(), &byte, 1, MSG_PEEK);
+#ifdef _WIN32
+                const bool would_block = result < 0 && ::WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+                const bool would_block = result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif //_WIN32
+
+                error_code restore_ec{};
+                lowest.non_blocking(was_non_blocking, restore_ec);
+                return result > 0 || would_block;
+            }
+
+            /**
+             * @brief Get the executor of the underlying socket. Coroutines using the connection
+             * should be spawned on this executor
+             * 
+             * @return The executor
+             */
+            auto get_executor()
+            {
+                return socket.get_executor();
+            }
+
+            /**
+             * @brief Send data on the socket. On stream protocols buffer sequences go through the
+             * connection's send queue, so concurrent sends are serialized and those issued while a 
+             * write is in flight are coalesced into one gathered write. Datagram connections made with
+             * Connect(host, service) send on the connected socket rather than to an address
              * 
              * @tparam T The message type
              * @param data The message
@@ -98,16 +336,89 @@ namespace Brilliant
             template<class T>
             asio::awaitable<std::pair<std::size_t, error_code>> Send(T&& data)
             {
-                if constexpr (is_datagram_protocol_v<typename protocol_type::protocol_type>)
+                return Send(std::forward<T>(data), timeouts.send);
+            }
+
+            /**
+             * @brief Send data on the socket, cancelling the send if that takes longer than the timeout. Only
+             * the send's own write is cancelled, reads carry on. The connection should be disconnected after
+             * a send times out, part of the message may have been written
+             * 
+             * @tparam T The message type
+             * @param data The message
+             * @param timeout The deadline, zero for none
+             * @return The number of bytes written to the socket and the first error to occur if there was one,
+             * asio::error::timed_out if the deadline passed
+             */
+            template<class T>
+            asio::awaitable<std::pair<std::size_t, error_code>> Send(T&& data, std::chrono::steady_clock::duration timeout)
+            {
+                if constexpr (is_queued_send_v<T>)
                 {
-                    return impl.Send(socket, remote_endpoint, std::forward<T>(data));
+                    //the queue times sends out with the timer each queued send already has
+                    return Touched(send_queue.Send(impl, socket, data, timeout));
                 }
                 else
                 {
-                    return impl.Send(socket, std::forward<T>(data));
+                    if (timeout.count() <= 0)
+                    {
+                        return SendNow(std::forward<T>(data));
+                    }
+
+                    //concurrent sends are allowed, so each gets its own deadline
+                    return Before(nullptr, nullptr, timeout, [this, &data](asio::cancellation_slot slot, error_code& ec) {
+                        if constexpr (requires { impl.AsyncSend(socket, data, asio::use_awaitable); })
+                        {
+                            return Send(data, asio::bind_cancellation_slot(slot, asio::redirect_error(asio::use_awaitable, ec)));
+                        }
+                        else
+                        {
+                            return asio::co_spawn(socket.get_executor(), Cancellable(SendNow(data)), asio::bind_cancellation_slot(slot, asio::use_awaitable));
+                        }
+                    });
                 }
             }
 
+            /**
+             * @brief Send data on the socket, completing through any asio completion token. The write starts
+             * directly, with no coroutine frame, so a callback costs no more than the asio operation. Bypasses
+             * the send queue and the default send deadline, so do not overlap it with other sends
+             * 
+             * @tparam T The message type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param data The message. Must stay valid, as must the connection, until the send completes
+             * @param token Completed as void(error_code, std::size_t) with the first error and the number of bytes written
+             * @return As given by the completion token
+             */
+            template<class T, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto Send(const T& data, CompletionToken&& token)
+            {
+                //one initiation for both paths, so lazy tokens such as asio::deferred yield a single type
+                return asio::async_initiate<CompletionToken, void(error_code, std::size_t)>([this](auto handler, auto held) {
+                    const std::unwrap_reference_t<decltype(held)>& data = held;
+                    idle.Touch();
+                    if constexpr (is_datagram_protocol_v<typename protocol_type::protocol_type>)
+                    {
+                        if (!connected)
+                        {
+                            impl.AsyncSend(socket, remote_endpoint, data, TouchOnCompletion(std::move(handler)));
+                            return;
+                        }
+                    }
+                    impl.AsyncSend(socket, data, TouchOnCompletion(std::move(handler)));
+                }, token, Hold(data));
+            }
+
+            /**
+             * @brief Set the limits and cork time of the send queue
+             * 
+             * @param options The send queue options
+             */
+            void SetSendQueueOptions(const SendQueueOptions& options)
+            {
+                send_queue.SetOptions(options);
+            }
+
             /**
              * @brief Read data from the socket into a message
              * 
@@ -117,26 +428,515 @@ namespace Brilliant
              */
             template<class T>
             asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(T&& data)
+            {
+                return ReadInto(std::forward<T>(data), timeouts.read);
+            }
+
+            /**
+             * @brief Read data from the socket into a message, cancelling the read if that takes longer than
+             * the timeout, ie when a peer trickles a message in slowly. Sends in flight are not cancelled
+             * 
+             * @tparam T The message type
+             * @param data The message
+             * @param timeout The deadline, zero for none
+             * @return The number of bytes read and the first error to occur if there was one, asio::error::timed_out
+             * if the deadline passed
+             */
+            template<class T>
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(T&& data, std::chrono::steady_clock::duration timeout)
+            {
+                if (timeout.count() <= 0)
+                {
+                    return ReadNow(std::forward<T>(data));
+                }
+
+                return Before(&read_deadline, &read_signal, timeout, [this, &data](asio::cancellation_slot slot, error_code& ec) {
+                    if constexpr (requires { impl.AsyncReadInto(socket, data, asio::use_awaitable); })
+                    {
+                        //started with a token, so the read takes no frame of its own
+                        return ReadInto(data, asio::bind_cancellation_slot(slot, asio::redirect_error(asio::use_awaitable, ec)));
+                    }
+                    else
+                    {
+                        return asio::co_spawn(socket.get_executor(), Cancellable(ReadNow(data)), asio::bind_cancellation_slot(slot, asio::use_awaitable));
+                    }
+                });
+            }
+
+            /**
+             * @brief Read data from the socket into a message, completing through any asio completion token.
+             * The read starts directly, with no coroutine frame. Not bounded by the default read deadline
+             * 
+             * @tparam T The message type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param data The message. Must stay valid, as must the connection, until the read completes
+             * @param token Completed as void(error_code, std::size_t) with the first error and the number of bytes read
+             * @return As given by the completion token
+             */
+            template<class T, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto ReadInto(T&& data, CompletionToken&& token)
+            {
+                //one initiation for both paths, so lazy tokens such as asio::deferred yield a single type
+                return asio::async_initiate<CompletionToken, void(error_code, std::size_t)>([this](auto handler, auto held) {
+                    std::unwrap_reference_t<decltype(held)>& data = held;
+                    idle.Touch();
+                    if constexpr (is_datagram_protocol_v<typename protocol_type::protocol_type>)
+                    {
+                        if (!connected)
+                        {
+                            impl.AsyncReadInto(socket, remote_endpoint, data, TouchOnCompletion(std::move(handler)));
+                            return;
+                        }
+                    }
+                    impl.AsyncReadInto(socket, data, TouchOnCompletion(std::move(handler)));
+                }, token, Hold(data));
+            }
+
+            /**
+             * @brief Wait for datagrams then receive all that are available, up to one per buffer
+             * 
+             * @param buffers One buffer per datagram. Each buffer is shrunk to the size of the datagram received into it
+             * @param sources Receives the source endpoint of each datagram. May be empty, otherwise at least as large as buffers
+             * @return The number of datagrams received and the first error to occur if there was one
+             */
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadBatch(std::span<asio::mutable_buffer> buffers, std::span<typename protocol_type::endpoint_type> sources = {})
+                requires (is_datagram_protocol_v<typename protocol_type::protocol_type>)
+            {
+                return Touched(impl.ReadBatch(socket, buffers, sources));
+            }
+
+            /**
+             * @brief Send a batch of datagrams to the remote endpoint
+             * 
+             * @param buffers One buffer per datagram
+             * @return The number of datagrams sent and the first error to occur if there was one
+             */
+            asio::awaitable<std::pair<std::size_t, error_code>> SendBatch(std::span<const asio::const_buffer> buffers)
+                requires (is_datagram_protocol_v<typename protocol_type::protocol_type>)
+            {
+                if (connected)
+                {
+                    return Touched(impl.SendBatch(socket, buffers, std::span<const typename protocol_type::endpoint_type>{}));
+                }
+                return Touched(impl.SendBatch(socket, buffers, std::span<const typename protocol_type::endpoint_type>{ &remote_endpoint, 1 }));
+            }
+
+            /**
+             * @brief Send data to the remote endpoint as a run of equal sized datagrams, using udp
+             * segmentation offload where available
+             * 
+             * @tparam ConstBufferSequence The buffer sequence type
+             * @param data The data to send
+             * @param segment_size The datagram payload size, the last datagram may be shorter
+             * @return The number of bytes written and the first error to occur if there was one
+             */
+            template<class ConstBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> SendSegments(const ConstBufferSequence& data, std::size_t segment_size)
+                requires (std::is_same_v<typename protocol_type::protocol_type, asio::ip::udp>)
+            {
+                return Touched(impl.SendSegments(socket, remote_endpoint, data, segment_size));
+            }
+
+            /**
+             * @brief Read a datagram, or a run of datagrams coalesced by udp receive offload where available
+             * 
+             * @param data The buffer to read into
+             * @param[out] segment_size The size of each datagram in data, the last may be shorter
+             * @return The number of bytes read and the first error to occur if there was one
+             */
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadSegments(asio::mutable_buffer data, std::size_t& segment_size)
+                requires (std::is_same_v<typename protocol_type::protocol_type, asio::ip::udp>)
+            {
+                return Touched(impl.ReadSegments(socket, remote_endpoint, data, segment_size));
+            }
+
+            /**
+             * @brief Read whatever is available from the socket into the connection's read buffer
+             * with a single read
+             * 
+             * @return A view of all unconsumed bytes, valid until the next read or Consume, and the
+             * first error to occur if there was one
+             */
+            auto ReadSome()
+            {
+                return Touched(impl.ReadSome(socket));
+            }
+
+            /**
+             * @brief Discard bytes returned by ReadSome once they have been processed
+             * 
+             * @param n The number of bytes to discard
+             */
+            void Consume(std::size_t n)
+            {
+                impl.Consume(n);
+            }
+
+            /**
+             * @brief Get the protocol implementation, allowing per connection protocol settings
+             * 
+             * @return The protocol implementation
+             */
+            protocol_type& GetProtocol()
+            {
+                return impl;
+            }
+
+            /**
+             * @brief Record the IoContextPool context a server placed the connection on, so the server removes
+             * exactly that context's load when the connection is released
+             * 
+             * @param index The context index, empty if the connection's load was not counted
+             */
+            void SetPoolIndex(std::optional<std::size_t> index)
+            {
+                pool_index = index;
+            }
+
+            /**
+             * @brief Get the IoContextPool context a server placed the connection on
+             * 
+             * @return The context index, empty if the connection's load was not counted
+             */
+            std::optional<std::size_t> GetPoolIndex() const
+            {
+                return pool_index;
+            }
+
+            /**
+             * @brief Get the activity stamp an IdleReaper reads, recorded when a send or read starts and again when it completes
+             * 
+             * @return The idle tracking
+             */
+            IdleTracking& GetIdleTracking()
+            {
+                return idle;
+            }
+
+        private:
+            //! True if sends of T go through the send queue, ie buffer sequences on stream protocols
+            template<class T>
+            static constexpr bool is_queued_send_v = !is_datagram_protocol_v<typename protocol_type::protocol_type> &&
+                asio::is_const_buffer_sequence<std::remove_cvref_t<T>>::value &&
+                requires (protocol_type& impl, socket_type& socket, const std::vector<asio::const_buffer>& buffers) { impl.Send(socket, buffers); };
+
+            /**
+             * @brief Send data on the socket without a deadline
+             * 
+             * @tparam T The message type
+             * @param data The message
+             * @return The number of bytes written to the socket and the first error to occur if there was one
+             */
+            template<class T>
+            asio::awaitable<std::pair<std::size_t, error_code>> SendNow(T&& data)
             {
                 if constexpr (is_datagram_protocol_v<typename protocol_type::protocol_type>)
                 {
-                    return impl.ReadInto(socket, remote_endpoint, std::forward<T>(data));
+                    if (connected)
+                    {
+                        return Touched(impl.Send(socket, std::forward<T>(data)));
+                    }
+                    return Touched(impl.Send(socket, remote_endpoint, std::forward<T>(data)));
+                }
+                else if constexpr (is_queued_send_v<T>)
+                {
+                    return Touched(send_queue.Send(impl, socket, data));
                 }
                 else
                 {
-                    return impl.ReadInto(socket, std::forward<T>(data));
+                    return Touched(impl.Send(socket, std::forward<T>(data)));
                 }
             }
 
-        private:
+            /**
+             * @brief Read data from the socket into a message without a deadline
+             * 
+             * @tparam T The message type
+             * @param data The message
+             * @return The number of bytes read and the first error to occur if there was one
+             */
+            template<class T>
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadNow(T&& data)
+            {
+                if constexpr (is_datagram_protocol_v<typename protocol_type::protocol_type>)
+                {
+                    if (connected)
+                    {
+                        return Touched(impl.ReadInto(socket, std::forward<T>(data)));
+                    }
+                    return Touched(impl.ReadInto(socket, remote_endpoint, std::forward<T>(data)));
+                }
+                else
+                {
+                    return Touched(impl.ReadInto(socket, std::forward<T>(data)));
+                }
+            }
+
+            /**
+             * @brief Run a send or read, cancelling just that operation through a cancellation slot if it
+             * does not finish in time
+             * 
+             * @tparam Start Callable as start(slot, ec), starting the operation with the slot bound. Returns
+             * an awaitable of the bytes transferred, setting ec, or of the bytes and error as a pair
+             * @param deadline The deadline to use, or null to use one of its own
+             * @param signal The signal to cancel with, or null when the deadline is null
+             * @param timeout How long the operation may take
+             * @param start Starts the operation
+             * @return The result of the operation, with asio::error::timed_out if the deadline passed
+             */
+            template<class Start>
+            asio::awaitable<std::pair<std::size_t, error_code>> Before(Deadline* deadline, asio::cancellation_signal* signal, std::chrono::steady_clock::duration timeout, Start start)
+            {
+                std::optional<Deadline> own_deadline;
+                std::optional<asio::cancellation_signal> own_signal;
+                if (!deadline)
+                {
+                    deadline = &own_deadline.emplace(socket.get_executor());
+                    signal = &own_signal.emplace();
+                }
+
+                //emitted on this coroutine's executor, which bound the signal's slot and clears it on completion
+                deadline->Start(timeout, co_await asio::this_coro::executor, [signal] { signal->emit(asio::cancellation_type::terminal); });
+                std::pair<std::size_t, error_code> result{};
+                if constexpr (std::is_same_v<std::invoke_result_t<Start&, asio::cancellation_slot, error_code&>, asio::awaitable<std::size_t>>)
+                {
+                    result.first = co_await start(signal->slot(), result.second);
+                }
+                else
+                {
+                    result = co_await start(signal->slot(), result.second);
+                }
+                deadline->Stop();
+
+                if (deadline->Expired())
+                {
+                    result.second = asio::error::timed_out;
+                }
+                co_return result;
+            }
+
+            /**
+             * @brief Connect(host, service) with its own copies of the host and service, which live in the frame
+             * 
+             * @param host The host to connect to
+             * @param service The service to connect to
+             * @return The first error that occurred during connection if there was one
+             */
+            asio::awaitable<error_code> ConnectTo(std::string host, std::string service)
+            {
+                co_return co_await Connect(host, service);
+            }
+
+            /**
+             * @brief Run a connect for a token operation, completing the handler with just its error. The
+             * handler's executor and cancellation slot are kept
+             * 
+             * @tparam Handler The handler type
+             * @param operation The connect, not started yet
+             * @param handler The handler
+             */
+            template<class Handler>
+            void SpawnConnect(asio::awaitable<error_code> operation, Handler handler)
+            {
+                auto executor = asio::get_associated_executor(handler, socket.get_executor());
+                auto slot = asio::get_associated_cancellation_slot(handler);
+                asio::co_spawn(socket.get_executor(), Cancellable(std::move(operation)), asio::bind_cancellation_slot(slot, asio::bind_executor(executor,
+                    [handler = std::move(handler)](std::exception_ptr e, error_code ec) mutable {
+                        //connect reports failures as errors, anything thrown is a bug or out of memory
+                        if (e) { std::rethrow_exception(e); }
+                        std::move(handler)(ec);
+                    })));
+            }
+
+            /**
+             * @brief Hold the data of a token operation until it starts. Buffer sequences are copied, as asio
+             * operations do, so a temporary buffer outlives a lazy token. Messages are held by reference
+             * 
+             * @tparam T The message type
+             * @param data The message
+             * @return The buffer sequence, or a reference wrapper for the message
+             */
+            template<class T>
+            static auto Hold(T& data)
+            {
+                if constexpr (asio::is_const_buffer_sequence<std::remove_const_t<T>>::value)
+                {
+                    return std::remove_const_t<T>{ data };
+                }
+                else
+                {
+                    return std::ref(data);
+                }
+            }
+
+            /**
+             * @brief Run a send or read, counting the connection as active when it starts and again when it
+             * completes, so a long transfer still moving data is not reaped partway
+             * 
+             * @tparam T The result type
+             * @param operation The operation, not started yet
+             * @return The result of the operation
+             */
+            template<class T>
+            asio::awaitable<T> Touched(asio::awaitable<T> operation)
+            {
+                idle.Touch();
+                T result = co_await std::move(operation);
+                idle.Touch();
+                co_return result;
+            }
+
+            /**
+             * @brief Wrap the handler of a token operation so the connection counts as active when it completes,
+             * keeping the handler's executor and cancellation slot. An aborted operation is not activity
+             * 
+             * @tparam Handler The handler type
+             * @param handler The handler
+             * @return The wrapped handler
+             */
+            template<class Handler>
+            auto TouchOnCompletion(Handler handler)
+            {
+                auto executor = asio::get_associated_executor(handler, socket.get_executor());
+                auto slot = asio::get_associated_cancellation_slot(handler);
+                return asio::bind_cancellation_slot(slot, asio::bind_executor(executor, [this, handler = std::move(handler)](const error_code& ec, std::size_t size) mutable {
+                    if (ec != asio::error::operation_aborted)
+                    {
+                        idle.Touch();
+                    }
+                    std::move(handler)(ec, size);
+                }));
+            }
+
+            /**
+             * @brief Run an operation in its own coroutine for co_spawn, for operations with no completion
+             * token form. A cancelled operation then reports its error rather than throwing at its next wait
+             * 
+             * @tparam T The result type
+             * @param operation The operation, not started yet
+             * @return The result of the operation
+             */
+            template<class T>
+            static asio::awaitable<T> Cancellable(asio::awaitable<T> operation)
+            {
+                co_await asio::this_coro::throw_if_cancelled(false);
+                co_return co_await std::move(operation);
+            }
+
+            /**
+             * @brief The server side connect, cancelling it if it does not finish in time. A handshake on a
+             * HandshakePool runs its socket operations on the pool's threads, so it is cancelled through the
+             * connect signal and the socket is only closed here once the handshake has ended
+             * 
+             * @param timeout How long the connect may take, zero for none
+             * @return The first error that occurred during connection if there was one, asio::error::timed_out if the deadline
+             * passed, asio::error::operation_aborted if the connection was closed during the handshake
+             */
+            asio::awaitable<error_code> ConnectBefore(std::chrono::steady_clock::duration timeout)
+            {
+                pooled_handshake = IsHandshakePooled();
+                close_pending = false;
+                connect_deadline.Start(timeout, co_await asio::this_coro::executor, [this] {
+                    connect_signal.emit(asio::cancellation_type::terminal);
+                    if (!pooled_handshake) { CloseLowest(); }
+                });
+                auto ec = co_await asio::co_spawn(socket.get_executor(), Cancellable(impl.Connect(socket)),
+                    asio::bind_cancellation_slot(connect_signal.slot(), asio::use_awaitable));
+                connect_deadline.Stop();
+                pooled_handshake = false;
+
+                if (connect_deadline.Expired())
+                {
+                    impl.Disconnect(socket);
+                    ec = asio::error::timed_out;
+                }
+                else if (std::exchange(close_pending, false))
+                {
+                    Close();
+                    ec = asio::error::operation_aborted;
+                }
+                co_return ec;
+            }
+
+            /**
+             * @brief Tells if the server handshake runs on a HandshakePool
+             * 
+             * @return True if a pool is set
+             */
+            bool IsHandshakePooled() const
+            {
+                if constexpr (requires { impl.GetHandshakePool(); })
+                {
+                    return impl.GetHandshakePool() != nullptr;
+                }
+                return false;
+            }
+
+            /**
+             * @brief Cancel a pooled handshake in progress rather than closing its socket from this thread
+             * 
+             * @return True if the close was deferred until the handshake ends
+             */
+            bool DeferClose()
+            {
+                if (!pooled_handshake) { return false; }
+
+                close_pending = true;
+                connect_signal.emit(asio::cancellation_type::terminal);
+                return true;
+            }
+
+            /**
+             * @brief Close the lowest layer of the socket, aborting a connect or handshake in progress
+             * 
+             */
+            void CloseLowest()
+            {
+                error_code ec{};
+                GetLowestSocket(socket).close(ec);
+            }
+
             //! The underlying socket
             socket_type socket;
 
             //! The remote endpoint 
             typename protocol_type::endpoint_type remote_endpoint;
 
+            //! Set while a datagram socket is connected to remote_endpoint, sends and reads then skip the address
+            bool connected = false;
+
             //! The protocol implementation 
             protocol_type impl;
+
+            //! Serializes and coalesces sends on stream protocols
+            SendQueue send_queue;
+
+            //! The deadlines used when an operation is not given one
+            TimeoutOptions timeouts;
+
+            //! Closes the socket when Connect runs too long
+            Deadline connect_deadline;
+
+            //! Bound to Connect while it is cancellable, so the deadline can abandon a connect race or a pooled handshake
+            asio::cancellation_signal connect_signal;
+
+            //! Set while the server handshake runs on a HandshakePool
+            bool pooled_handshake = false;
+
+            //! Set when the connection was closed during a pooled handshake, the socket is closed once it ends
+            bool close_pending = false;
+
+            //! Cancels the read when ReadInto runs too long. Sends time out in the send queue, or make their own
+            Deadline read_deadline;
+
+            //! Bound to the read ReadInto's deadline is running for
+            asio::cancellation_signal read_signal;
+
+            //! The latest activity, for the server's idle reaper
+            IdleTracking idle;
+
+            //! The IoContextPool context a server placed the connection on, if its load was counted
+            std::optional<std::size_t> pool_index;
         };
     }
 }
\ No newline at end of file
@@ -12,9 +12,19 @@
 #pragma once
 
 #include <charconv>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
 
 #include "AwaitableConnection.h"
+#include "ConnectionPool.h"
 #include "EndpointHelper.h"
+#include "IdleReaper.h"
+#include "IoContextPool.h"
+#include "SocketOptions.h"
 
 namespace Brilliant
 {
@@ -33,6 +43,8 @@ namespace Brilliant
             using base_protocol_type = typename Protocol::protocol_type;
             using acceptor_type = typename protocol_type::acceptor_type;
             using connection_type = AwaitableConnection<protocol_type>;
+            using endpoint_type = typename protocol_type::endpoint_type;
+            using placement_type = std::function<std::size_t(const IoContextPool&, const endpoint_type&)>;
 
             /**
              * @brief Construct a new Awaitable Server object
@@ -46,67 +58,193 @@ namespace Brilliant
             }
 
             /**
-             * @brief Destroy the Awaitable Server object
+             * @brief Construct a new Awaitable Server object which places each accepted connection
+             * on one of the contexts of an IoContextPool. A connection's socket is bound to the chosen
+             * context for its whole life, spawn its coroutines on connection->get_executor()
+             * 
+             * @param pool The pool to place connections on. Must outlive the server
+             * @param placement Chooses the pool context index for an accepted connection from its peer endpoint
+             */
+            AwaitableServer(IoContextPool& pool, placement_type placement = RoundRobinPlacement{}) : 
+                executor(pool.GetExecutor(0)),
+                pool(&pool),
+                placement(std::move(placement))
+            {
+
+            }
+
+            /**
+             * @brief Destroy the Awaitable Server object. Its acceptors and connections are closed from the calling
+             * thread, so the contexts they run on must no longer be running the server's accept loops and connections
              * 
              */
             ~AwaitableServer()
             {
-                Disconnect();
+                std::lock_guard lock(shared->mutex);
+                shared->alive = false;
+                if (reaper)
+                {
+                    reaper->Stop();
+                }
+
+                for (auto& acceptor : acceptors)
+                {
+                    error_code ec{};
+                    acceptor.cancel(ec);
+                }
+
+                connections.ForEach([](connection_type& connection) {
+                    connection.Disconnect();
+                });
             }
 
             /**
-             * @brief Stop all acceptors and disconnect all active connections
+             * @brief Stop all acceptors, stop reaping idle connections and disconnect all active connections.
+             * Acceptors and connections may run on other threads, so each is cancelled or disconnected on its
+             * own executor and this returns before that has happened
              * 
              */
             void Disconnect()
             {
+                std::lock_guard lock(shared->mutex);
                 for (auto& acceptor : acceptors)
                 {
-                    acceptor.cancel();
+                    asio::post(acceptor.get_executor(), [shared = shared, acceptor = &acceptor]() {
+                        std::lock_guard lock(shared->mutex);
+                        if (!shared->alive) { return; }
+
+                        error_code ec{};
+                        acceptor->cancel(ec);
+                    });
                 }
 
-                for (auto& connection : connections)
+                //kept until the server is destroyed, connections on other threads may still be reading its clock
+                if (reaper)
                 {
-                    connection.Disconnect();
+                    reaper->Stop();
+                }
+
+                connections.ForEach([this](connection_type& connection) {
+                    asio::post(connection.get_executor(), [this, shared = shared, connection = &connection, generation = connections.Generation(&connection)]() {
+                        //the connection may have been released, and its slot reused, before this ran
+                        std::lock_guard lock(shared->mutex);
+                        if (!shared->alive || !connections.Holds(connection, generation)) { return; }
+
+                        connection->Disconnect();
+                    });
+                });
+            }
+
+            /**
+             * @brief Run the tls handshakes of connections accepted from now on, done by connection->Connect(),
+             * on a worker pool so a burst of new clients does not stall established connections
+             * 
+             * @param handshakes The pool, which must outlive the connections, or null to handshake on the connection's executor
+             */
+            void SetHandshakePool(HandshakePool* handshakes)
+                requires (is_ssl_wrapped_v<typename protocol_type::socket_type>)
+            {
+                std::lock_guard lock(shared->mutex);
+                handshake_pool = handshakes;
+            }
+
+            /**
+             * @brief Disconnect connections with no Send, ReadInto or ReadSome started for longer than the timeout,
+             * including half-open ones whose peer vanished. All connections share one timing wheel ticking on the
+             * server's executor, so there is no timer per connection. A reaped connection's pending operations
+             * fail and its owner should Release it as usual. Takes effect once, later calls are ignored
+             * 
+             * @param timeout How long a connection may be idle
+             * @param resolution How often the wheel ticks. Connections are reaped up to this much late
+             */
+            void SetIdleTimeout(std::chrono::steady_clock::duration timeout, std::chrono::steady_clock::duration resolution = std::chrono::seconds(1))
+            {
+                std::lock_guard lock(shared->mutex);
+                if (reaper || timeout.count() <= 0) { return; }
+
+                reaper = std::make_shared<IdleReaper<connection_type>>(executor, timeout, resolution);
+                reaper->Start();
+                connections.ForEach([this](connection_type& connection) {
+                    reaper->Track(&connection);
+                });
+            }
+
+            /**
+             * @brief Get the number of connections disconnected for being idle
+             * 
+             * @return The number of connections
+             */
+            std::size_t Reaped() const
+            {
+                std::lock_guard lock(shared->mutex);
+                return reaper ? reaper->Reaped() : 0;
+            }
+
+            /**
+             * @brief Disconnect a connection and return its storage to the server for reuse.
+             * The pointer must not be used after this call
+             * 
+             * @param connection A connection previously yielded by AcceptOn
+             */
+            void Release(connection_type* connection)
+            {
+                if (!connection) { return; }
+
+                connection->Disconnect();
+
+                std::lock_guard lock(shared->mutex);
+                if (reaper)
+                {
+                    reaper->Untrack(connection);
                 }
+
+                if (auto index = connection->GetPoolIndex(); pool && index)
+                {
+                    pool->RemoveLoad(*index);
+                }
+                connections.Release(connection);
             }
 
             //TODO: Consider returning a ref/handle to the acceptor so we can stop it
             /**
-             * @brief Accept connections on the given service
+             * @brief Accept connections on the given service. The acceptor is bound to the executor
+             * of the calling coroutine. For a sharded listener, call this once from a coroutine on each
+             * io_context with options.reuse_port set and the kernel will spread connections across them
              * @param service The service to accept connections on as a string
+             * @param options Options applied to the acceptor
              * @return A generator of pointers to connections
              */
             asio::experimental::generator<connection_type*>
-                AcceptOn(std::string_view service) 
+                AcceptOn(std::string_view service, AcceptorOptions options = {}) 
                 requires (!is_datagram_protocol_v<base_protocol_type>)
             {
                 static_assert(!is_ssl_wrapped_v<typename protocol_type::socket_type>, "Cannot use protocol with socket type of asio::ssl::stream<T> with this overload");
 
                 error_code ec{};
-                auto& acceptor = acceptors.emplace_back(co_await asio::this_coro::executor); //use basic_socket_acceptor in case of generic protocol
-                InitAcceptor(acceptor, service, ec);
+                auto& acceptor = MakeAcceptor(co_await asio::this_coro::executor, service, options, ec);
                 if (ec)
                 {
-                    acceptors.pop_back();
+                    co_return;
                 }
 
-                while (!ec && acceptor.is_open())
+                while (acceptor.is_open())
                 {
                     typename protocol_type::socket_type socket{ co_await asio::this_coro::executor };
                     co_await protocol_type::Accept(acceptor, socket);
-                    auto& result = connections.emplace_back(std::move(socket));
-                    co_yield &result;
+                    std::optional<std::size_t> index;
+                    auto placed = PlaceSocket(std::move(socket), index);
+                    co_yield AddConnection(std::move(placed), index);
                 }
             }
 
             /**
              * @brief Accept connections on the given service
              * @param service The service to accept connections on as a string
+             * @param options Options applied to the socket before it is bound
              * @return A generator of pointers to connections
              */
             asio::awaitable<connection_type*>
-                AcceptOn(std::string_view service)
+                AcceptOn(std::string_view service, AcceptorOptions options = {})
                 requires (is_datagram_protocol_v<base_protocol_type>)
             {
                 error_code ec{};
@@ -116,9 +254,17 @@ namespace Brilliant
                     co_return nullptr;
                 }
 
-                typename protocol_type::socket_type socket{ co_await asio::this_coro::executor, ep };
-                auto& result = connections.emplace_back(std::move(socket));
-                co_return &result;
+                typename protocol_type::socket_type socket{ co_await asio::this_coro::executor };
+                socket.open(ep.protocol(), ec);
+                if (ec) { co_return nullptr; }
+
+                ApplyBindOptions(socket, options, ec);
+                if (ec) { co_return nullptr; }
+
+                socket.bind(ep, ec);
+                if (ec) { co_return nullptr; }
+
+                co_return AddConnection(std::move(socket));
             }
 
             //TODO: return type should include error code
@@ -127,20 +273,20 @@ namespace Brilliant
              * @brief Accept ssl wrapped connections on the given service 
              * @param service The service to accept on as a string
              * @param ssl The ssl context to use for incoming connections
+             * @param options Options applied to the acceptor
              * @return A generator of pointers to connections
              */
             asio::experimental::generator<connection_type*>
-                AcceptOn(std::string_view service, asio::ssl::context& ssl)
+                AcceptOn(std::string_view service, asio::ssl::context& ssl, AcceptorOptions options = {})
             {
                 static_assert(!is_datagram_protocol_v<base_protocol_type>, "Cannot use ssl with a datagram protocol");
                 static_assert(is_ssl_wrapped_v<typename protocol_type::socket_type>, "Must provide Protocol socket type of asio::ssl::stream<T>");
 
                 error_code ec{};
-                auto& acceptor = acceptors.emplace_back(co_await asio::this_coro::executor); //use basic_socket_acceptor in case of generic protocol
-                InitAcceptor(acceptor, service, ec);
+                auto& acceptor = MakeAcceptor(co_await asio::this_coro::executor, service, options, ec);
                 if (ec)
                 {
-                    acceptors.pop_back();
+                    co_return;
                 }
 
                 while (acceptor.is_open())
@@ -150,9 +296,9 @@ namespace Brilliant
                     // //coro requires that yield value has default ctor
                     co_await acceptor.async_accept(socket, asio::experimental::use_coro); //TODO: this will throw, asio::redirect_error() will not compile
 
-                    typename protocol_type::socket_type ssl_socket{ std::move(socket), ssl };
-                    auto& result = connections.emplace_back(std::move(ssl_socket));
-                    co_yield &result;
+                    std::optional<std::size_t> index;
+                    typename protocol_type::socket_type ssl_socket{ PlaceSocket(std::move(socket), index), ssl };
+                    co_yield AddConnection(std::move(ssl_socket), index);
                 }
             }
 
@@ -168,14 +314,36 @@ namespace Brilliant
             }
 
         private:
+            /**
+             * @brief Create and initialize an acceptor owned by the server
+             * 
+             * @param exec The executor the acceptor is bound to
+             * @param service The service to listen on
+             * @param options Options applied to the acceptor
+             * @param[out] ec An error_code that an error will be stored in if one occurs
+             * @return A reference to the acceptor which is only valid if no error occurred
+             */
+            acceptor_type& MakeAcceptor(asio::any_io_executor exec, std::string_view service, const AcceptorOptions& options, error_code& ec)
+            {
+                std::lock_guard lock(shared->mutex);
+                auto& acceptor = acceptors.emplace_back(exec); //use basic_socket_acceptor in case of generic protocol
+                InitAcceptor(acceptor, service, options, ec);
+                if (ec)
+                {
+                    acceptors.pop_back();
+                }
+                return acceptor;
+            }
+
             /**
              * @brief Initialize an acceptor
              * 
-             * @param acceptor 
-             * @param service 
-             * @param ec 
+             * @param acceptor The acceptor
+             * @param service The service to listen on
+             * @param options Options applied to the acceptor
+             * @param[out] ec An error_code that an error will be stored in if one occurs
              */
-            void InitAcceptor(acceptor_type& acceptor, std::string_view service, error_code& ec)
+            void InitAcceptor(acceptor_type& acceptor, std::string_view service, const AcceptorOptions& options, error_code& ec)
             {
                 //TODO: use resolver here?
                 auto ep = MakeEndpointFromService<protocol_type>(service, ec);
@@ -183,24 +351,168 @@ namespace Brilliant
                 {
                     return;
                 }
-                acceptor.open(ep.protocol());
+                acceptor.open(ep.protocol(), ec);
+                if (ec)
+                {
+                    return;
+                }
+
+                ApplyBindOptions(acceptor, options, ec);
+                if (ec)
+                {
+                    return;
+                }
+
                 acceptor.bind(ep, ec);
                 if (ec)
                 {
                     return;
                 }
 
-                acceptor.listen();
+                ApplyListenOptions(acceptor, options, ec);
+                if (ec)
+                {
+                    return;
+                }
+
+                acceptor.listen(options.backlog, ec);
+            }
+
+            /**
+             * @brief Move an accepted socket onto the pool context chosen by the placement policy.
+             * Does nothing if the server was not constructed with a pool
+             * 
+             * @tparam Socket The socket type
+             * @param socket The accepted socket
+             * @param[out] index Set to the pool context the socket ended on, whose load was counted. Left empty
+             * without a pool, or if the socket is not on a pool context
+             * @return The socket, bound to the chosen context. Closed if moving it failed after its handle was released
+             */
+            template<class Socket>
+            Socket PlaceSocket(Socket socket, std::optional<std::size_t>& index)
+            {
+                if (!pool) { return socket; }
+
+                error_code ec{};
+                auto& lowest = GetLowestSocket(socket);
+                const auto peer = lowest.remote_endpoint(ec);
+                const auto local = lowest.local_endpoint(ec);
+
+                std::size_t chosen{};
+                {
+                    //counted at once so concurrent accepts see it, corrected below if the socket ends elsewhere
+                    std::lock_guard lock(shared->mutex);
+                    chosen = placement(*pool, peer) % pool->Size();
+                    pool->AddLoad(chosen);
+                }
+
+                auto exec = pool->GetExecutor(chosen);
+                if (lowest.get_executor() != exec)
+                {
+                    //move the native socket to the chosen context's reactor
+                    auto handle = lowest.release(ec);
+                    if (!ec)
+                    {
+                        Socket placed{ exec };
+                        GetLowestSocket(placed).assign(local.protocol(), handle, ec);
+                        if (ec)
+                        {
+                            //no socket owns the handle any more
+                            asio::detail::socket_ops::state_type state = 0;
+                            error_code close_ec{};
+                            asio::detail::socket_ops::close(handle, state, true, close_ec);
+                        }
+                        index = MoveLoad(chosen, GetLowestSocket(placed));
+                        return placed;
+                    }
+                }
+
+                index = MoveLoad(chosen, lowest);
+                return socket;
+            }
+
+            /**
+             * @brief Move the load counted on the chosen pool context to the one a placed socket ended on
+             * 
+             * @tparam Socket The lowest layer socket type
+             * @param chosen The context whose load was counted
+             * @param socket The placed socket
+             * @return The context the socket is on, empty if it is closed or not on a pool context
+             */
+            template<class Socket>
+            std::optional<std::size_t> MoveLoad(std::size_t chosen, Socket& socket)
+            {
+                const auto actual = socket.is_open() ? pool->IndexOf(socket.get_executor()) : pool->Size();
+                if (actual == chosen) { return actual; }
+
+                pool->RemoveLoad(chosen);
+                if (actual == pool->Size()) { return std::nullopt; }
+
+                pool->AddLoad(actual);
+                return actual;
+            }
+
+            /**
+             * @brief Construct a connection in the pool from an accepted socket
+             * 
+             * @param socket The socket
+             * @param index The pool context the socket was placed on, if its load was counted
+             * @return A pointer to the new connection
+             */
+            connection_type* AddConnection(typename protocol_type::socket_type socket, std::optional<std::size_t> index = {})
+            {
+                std::lock_guard lock(shared->mutex);
+                auto* connection = connections.Acquire(std::move(socket));
+                connection->SetPoolIndex(index);
+                if constexpr (is_ssl_wrapped_v<typename protocol_type::socket_type>)
+                {
+                    connection->SetHandshakePool(handshake_pool);
+                }
+
+                if (reaper)
+                {
+                    reaper->Track(connection);
+                }
+                return connection;
             }
 
             //! The asio executor used for asio coroutines
             asio::any_io_executor executor;
 
-            //! A vector of any acceptors created and managed by the AwaitableServer
-            std::vector<acceptor_type> acceptors;
+            //! The pool connections are placed on, if any
+            IoContextPool* pool = nullptr;
+
+            //! Chooses the pool context for each accepted connection
+            placement_type placement;
+
+            //! Runs the tls handshakes of accepted connections if set
+            HandshakePool* handshake_pool = nullptr;
+
+            //! A list of any acceptors created and managed by the AwaitableServer. A list keeps references stable across AcceptOn calls
+            std::list<acceptor_type> acceptors;
+
+            //! Connections created and managed by the AwaitableServer. Addresses are stable until released
+            ConnectionPool<connection_type> connections;
+
+            //! Disconnects idle connections if an idle timeout is set
+            std::shared_ptr<IdleReaper<connection_type>> reaper;
+
+            /**
+             * @struct Shared
+             * @brief Shared with work posted to the executors of acceptors and connections, which may run after
+             * the server is destroyed
+             */
+            struct Shared
+            {
+                //! Guards acceptors and connections, which are shared by accept loops running on different threads
+                std::mutex mutex;
+
+                //! Cleared when the server is destroyed
+                bool alive = true;
+            };
 
-            //! A vector of connections created and managed by the AwaitableServer
-            std::vector<connection_type> connections;
+            //! The mutex and liveness of the server
+            std::shared_ptr<Shared> shared = std::make_shared<Shared>();
         };
     }
 }
\ No newline at end of file
@@ -12,6 +12,9 @@
 #pragma once
 
 #include "AsioIncludes.h"
+#include "HandshakePool.h"
+#include "HappyEyeballs.h"
+#include "SslSessionCache.h"
 
 #ifdef BRILLIANT_NETWORK_HAS_BOOST_BEAST
 
@@ -43,6 +46,8 @@ namespace Brilliant
             {
                 if constexpr (UseSsl)
                 {
+                    if (handshake_pool) { co_return co_await handshake_pool->Handshake(socket, socket.server); }
+
                     error_code ec{};
                     co_await socket.async_handshake(socket.server, asio::redirect_error(asio::use_awaitable, ec));
                     co_return ec;
@@ -52,7 +57,8 @@ namespace Brilliant
             }
 
             /**
-             * @brief Connect to the given endpoint on the given socket
+             * @brief Connect to the given endpoint on the given socket. Attempts to the resolved
+             * addresses are raced, see ConnectOptions
              * 
              * @param socket The socket
              * @param host The endpoint host as a string
@@ -70,21 +76,69 @@ namespace Brilliant
 
                 if constexpr (UseSsl)
                 {
-                    ep = co_await boost::beast::get_lowest_layer(socket).async_connect(results, asio::redirect_error(asio::use_awaitable, ec));
+                    ep = co_await ConnectEndpoints(boost::beast::get_lowest_layer(socket).socket(), results, connect_options, ec);
                     if (ec) { co_return std::make_pair(endpoint_type{}, ec); };
 
+                    if (session_cache) { session_cache->Offer(socket.native_handle(), host, service); }
                     co_await socket.async_handshake(socket.client, asio::redirect_error(asio::use_awaitable, ec));
+                    if (session_cache) { session_cache->Complete(socket.native_handle(), ec); }
                     if (ec) { co_return std::make_pair(endpoint_type{}, ec); }
                 }
                 else
                 {
-                    ep = co_await socket.async_connect(results, asio::redirect_error(asio::use_awaitable, ec));
+                    ep = co_await ConnectEndpoints(socket.socket(), results, connect_options, ec);
                     if (ec) { co_return std::make_pair(endpoint_type{}, ec); }
                 }
 
                 co_return std::make_pair(ep, ec);;
             }
 
+            /**
+             * @brief Set how Connect tries the resolved addresses
+             * 
+             * @param options The connect options
+             */
+            void SetConnectOptions(const ConnectOptions& options)
+            {
+                connect_options = options;
+            }
+
+            /**
+             * @brief Set the cache Connect resumes tls sessions from. Uses SslSessionCache::Default()
+             * unless set. Sessions are only stored for ssl contexts set up with
+             * SslSessionCache::Install
+             * 
+             * @param cache The cache, which must outlive the socket, or null to disable resumption
+             */
+            void SetSessionCache(SslSessionCache* cache)
+                requires (UseSsl)
+            {
+                session_cache = cache;
+            }
+
+            /**
+             * @brief Set the pool the server handshake in Connect(socket) runs on. The handshake runs
+             * on the socket's executor unless set
+             * 
+             * @param pool The pool, which must outlive the socket, or null to handshake on the socket's executor
+             */
+            void SetHandshakePool(HandshakePool* pool)
+                requires (UseSsl)
+            {
+                handshake_pool = pool;
+            }
+
+            /**
+             * @brief Get the pool the server handshake runs on
+             * 
+             * @return The pool, or null if the handshake runs on the socket's executor
+             */
+            HandshakePool* GetHandshakePool() const
+                requires (UseSsl)
+            {
+                return handshake_pool;
+            }
+
             /**
              * @brief Disconnect the given socket
              * 
@@ -116,9 +170,58 @@ namespace Brilliant
                     lowest_layer.close(); //will this throw
                 }
 
+                //buffered bytes belong to the closed stream
+                buffer.clear();
+
                 return ec;
             }
 
+            /**
+             * @brief Disconnect the given socket without blocking. An https socket sends close_notify and waits
+             * for the peer's reply, up to the timeout, before the socket is closed
+             * 
+             * @param socket The socket
+             * @param timeout How long to wait for the peer to finish the tls shutdown
+             * @return boost::beast::error::timeout if the peer did not reply in time, or the first other error
+             * that occurred if there was one. The socket is closed either way
+             */
+            asio::awaitable<error_code> AsyncDisconnect(socket_type& socket, std::chrono::steady_clock::duration timeout)
+            {
+                if constexpr (UseSsl)
+                {
+                    error_code ec{};
+                    auto& lowest_layer = boost::beast::get_lowest_layer(socket);
+
+                    //buffered bytes belong to the closed stream
+                    buffer.clear();
+
+                    if (!IsConnected(socket)) { co_return ec; }
+
+                    //operations in progress would interleave with the shutdown
+                    lowest_layer.cancel();
+
+                    //the stream's own timeout closes the socket if the peer does not reply
+                    lowest_layer.expires_after(timeout);
+                    co_await socket.async_shutdown(asio::redirect_error(asio::use_awaitable, ec));
+                    lowest_layer.expires_never();
+
+                    if (ec == asio::error::eof || ec == asio::ssl::error::stream_truncated)
+                    {
+                        //the peer closed without replying, nothing more to wait for
+                        ec = {};
+                    }
+
+                    error_code close_ec{};
+                    lowest_layer.socket().shutdown(lowest_layer.socket().shutdown_both, close_ec);
+                    lowest_layer.socket().close(close_ec);
+                    co_return ec;
+                }
+                else
+                {
+                    co_return Disconnect(socket);
+                }
+            }
+
             /**
              * @brief Tells if the socket is connected
              * 
@@ -156,7 +259,27 @@ namespace Brilliant
             }
 
             /**
-             * @brief Read an http message from the socket
+             * @brief Send an http message on the socket, completing through any asio completion token.
+             * Starts the write directly, without a coroutine frame
+             * 
+             * @tparam B If the message is a request or response
+             * @tparam Body The message body type
+             * @tparam Fields The message fields type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param socket The socket to send the message on
+             * @param data The message. Must stay valid until the send completes
+             * @param token Completed as void(error_code, std::size_t) with the first error and the number of bytes sent
+             * @return As given by the completion token
+             */
+            template<bool B, class Body, class Fields, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncSend(socket_type& socket, const boost::beast::http::message<B, Body, Fields>& data, CompletionToken&& token)
+            {
+                return boost::beast::http::async_write(socket, data, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Read an http message from the socket. Bytes read past the end of the message
+             * are kept in the read buffer and used by the next read
              * 
              * @tparam B If the message is a request or response
              * @tparam Body The message body type
@@ -169,11 +292,51 @@ namespace Brilliant
             asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(socket_type& socket, boost::beast::http::message<B, Body, Fields>& data)
             {
                 error_code ec{};
-                boost::beast::flat_buffer buffer;
                 const std::size_t bytes_read = co_await boost::beast::http::async_read(socket, buffer, data, asio::redirect_error(asio::use_awaitable, ec));
                 co_return std::make_pair(bytes_read, ec);
             }
 
+            /**
+             * @brief Read an http message from the socket, completing through any asio completion token.
+             * Starts the read directly, without a coroutine frame
+             * 
+             * @tparam B If the message is a request or response
+             * @tparam Body The message body type
+             * @tparam Fields The message fields type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param socket The socket
+             * @param data The message. Must stay valid until the read completes
+             * @param token Completed as void(error_code, std::size_t) with the first error and the number of bytes read
+             * @return As given by the completion token
+             */
+            template<bool B, class Body, class Fields, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncReadInto(socket_type& socket, boost::beast::http::message<B, Body, Fields>& data, CompletionToken&& token)
+            {
+                return boost::beast::http::async_read(socket, buffer, data, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Set the maximum number of bytes the read buffer may hold. Reads which would 
+             * grow the buffer past this fail with boost::beast::http::error::buffer_overflow
+             * 
+             * @param limit The limit in bytes
+             */
+            void SetReadBufferLimit(std::size_t limit)
+            {
+                buffer.max_size(limit);
+            }
+
+            /**
+             * @brief Get the number of bytes read from the socket but not yet parsed,
+             * ie the start of a pipelined request
+             * 
+             * @return The number of buffered bytes
+             */
+            std::size_t BufferedBytes() const
+            {
+                return buffer.size();
+            }
+
             /**
              * @brief Accept on the given socket using an acceptor
              * 
@@ -187,6 +350,20 @@ namespace Brilliant
                 co_await acceptor.async_accept(socket.socket(), asio::experimental::use_coro);
                 co_return error_code{};
             }
+
+        private:
+            //! The read buffer, kept across reads so keep-alive connections do not allocate per 
+            //! message and pipelined messages are not lost
+            boost::beast::flat_buffer buffer;
+
+            //! How Connect tries the resolved addresses
+            ConnectOptions connect_options;
+
+            //! Offers and stores tls sessions in Connect, null to always do a full handshake
+            SslSessionCache* session_cache = &SslSessionCache::Default();
+
+            //! Runs the server handshake off the socket's executor if set
+            HandshakePool* handshake_pool = nullptr;
         };
 
         //! Convenience alias for an http protocol
@@ -12,9 +12,20 @@
 
 #pragma once
 
+#include <algorithm>
+#include <span>
+#include <vector>
+
 #include "AsioIncludes.h"
 #include "SocketTraits.h"
+#include "DatagramBatch.h"
+#include "Deadline.h"
 #include "EndpointHelper.h"
+#include "HappyEyeballs.h"
+#include "RingBuffer.h"
+#include "HandshakePool.h"
+#include "SslSessionCache.h"
+#include "UdpOffload.h"
 
 namespace Brilliant
 {
@@ -45,6 +56,8 @@ namespace Brilliant
             {
                 if constexpr (UseSsl)
                 {
+                    if (handshake_pool) { co_return co_await handshake_pool->Handshake(socket, socket.server); }
+
                     error_code ec{};
                     co_await socket.async_handshake(socket.server, asio::redirect_error(asio::use_awaitable, ec));
                     co_return ec;
@@ -54,7 +67,8 @@ namespace Brilliant
             }
 
             /**
-             * @brief Connect the socket to the endpoint at the given host and service
+             * @brief Connect the socket to the endpoint at the given host and service. Tcp attempts to
+             * the resolved addresses can be raced, see ConnectOptions
              * 
              * @param socket The socket
              * @param host The endpoint host
@@ -68,18 +82,66 @@ namespace Brilliant
                 
                 if (ec) { co_return std::make_pair(endpoint_type{}, ec); }
 
-                auto ep = co_await asio::async_connect(socket.lowest_layer(), results, asio::redirect_error(asio::use_awaitable, ec));
+                auto ep = co_await ConnectEndpoints(socket.lowest_layer(), results, connect_options, ec);
                 if (ec) { co_return std::make_pair(endpoint_type{}, ec); }
 
                 if constexpr (UseSsl)
                 {
+                    if (session_cache) { session_cache->Offer(socket.native_handle(), host, service); }
                     co_await socket.async_handshake(socket.client, asio::redirect_error(asio::use_awaitable, ec));
+                    if (session_cache) { session_cache->Complete(socket.native_handle(), ec); }
                     if (ec) { co_return std::make_pair(endpoint_type{}, ec); }
                 }
 
                 co_return std::make_pair(ep, ec);;
             }
 
+            /**
+             * @brief Set how Connect tries the resolved addresses
+             * 
+             * @param options The connect options
+             */
+            void SetConnectOptions(const ConnectOptions& options)
+            {
+                connect_options = options;
+            }
+
+            /**
+             * @brief Set the cache Connect resumes tls sessions from. Uses SslSessionCache::Default()
+             * unless set. Sessions are only stored for ssl contexts set up with
+             * SslSessionCache::Install
+             * 
+             * @param cache The cache, which must outlive the socket, or null to disable resumption
+             */
+            void SetSessionCache(SslSessionCache* cache)
+                requires (UseSsl)
+            {
+                session_cache = cache;
+            }
+
+            /**
+             * @brief Set the pool the server handshake in Connect(socket) runs on. The handshake runs
+             * on the socket's executor unless set
+             * 
+             * @param pool The pool, which must outlive the socket, or null to handshake on the socket's executor
+             */
+            void SetHandshakePool(HandshakePool* pool)
+                requires (UseSsl)
+            {
+                handshake_pool = pool;
+            }
+
+            /**
+             * @brief Get the pool the server handshake runs on
+             * 
+             * @return The pool, or null if the handshake runs on the socket's executor
+             */
+            HandshakePool* GetHandshakePool() const
+                requires (UseSsl)
+            {
+                return handshake_pool;
+            }
+
             /**
              * @brief Disconnect and close the socket
              * 
@@ -91,6 +153,9 @@ namespace Brilliant
                 error_code ec{};
                 auto& lowest_layer = socket.lowest_layer();
 
+                //buffered bytes belong to the closed stream
+                read_buffer.Clear();
+
                 lowest_layer.cancel(ec);
                 if (ec) { return ec; }
 
@@ -111,6 +176,60 @@ namespace Brilliant
                 return ec;
             }
 
+            /**
+             * @brief Disconnect and close the socket without blocking. An ssl socket sends close_notify and
+             * waits for the peer's reply, up to the timeout, before the socket is closed
+             * 
+             * @param socket The socket
+             * @param timeout How long to wait for the peer to finish the tls shutdown
+             * @return asio::error::timed_out if the peer did not reply in time, or the first other error to
+             * occur if there was one. The socket is closed either way
+             */
+            asio::awaitable<error_code> AsyncDisconnect(socket_type& socket, std::chrono::steady_clock::duration timeout)
+            {
+                if constexpr (UseSsl)
+                {
+                    error_code ec{};
+                    auto& lowest_layer = socket.lowest_layer();
+
+                    //buffered bytes belong to the closed stream
+                    read_buffer.Clear();
+
+                    if (!IsConnected(socket)) { co_return ec; }
+
+                    //operations in progress would interleave with the shutdown
+                    lowest_layer.cancel(ec);
+                    if (ec) { co_return ec; }
+
+                    Deadline deadline(socket.get_executor());
+                    deadline.Start(timeout, co_await asio::this_coro::executor, [&lowest_layer]() {
+                        error_code cancel_ec{};
+                        lowest_layer.cancel(cancel_ec);
+                    });
+                    co_await socket.async_shutdown(asio::redirect_error(asio::use_awaitable, ec));
+                    deadline.Stop();
+
+                    if (deadline.Expired())
+                    {
+                        ec = asio::error::timed_out;
+                    }
+                    else if (ec == asio::error::eof || ec == asio::ssl::error::stream_truncated)
+                    {
+                        //the peer closed without replying, nothing more to wait for
+                        ec = {};
+                    }
+
+                    error_code close_ec{};
+                    lowest_layer.shutdown(protocol_type::socket::shutdown_both, close_ec);
+                    lowest_layer.close(close_ec);
+                    co_return ec ? ec : close_ec;
+                }
+                else
+                {
+                    co_return Disconnect(socket);
+                }
+            }
+
             /**
              * @brief Query if the given socket is connected
              * 
@@ -123,13 +242,15 @@ namespace Brilliant
             }
 
             /**
-             * @brief Send data on the socket
+             * @brief Send data on the socket. Buffer sequences are written with a single gathered write
+             * @tparam ConstBufferSequence The buffer sequence type, ie asio::const_buffer, std::array or std::vector of buffers
              * @param socket The socket
              * @param data The data to send on the socket
              * @return The number of bytes sent and the first error to occur if there was one
              */
-            asio::awaitable<std::pair<std::size_t, error_code>> Send(socket_type& socket, const asio::const_buffer& data)
-                requires(!is_datagram_protocol_v<protocol_type>)
+            template<class ConstBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> Send(socket_type& socket, const ConstBufferSequence& data)
+                requires(!is_datagram_protocol_v<protocol_type> && asio::is_const_buffer_sequence<ConstBufferSequence>::value)
             {
                 error_code ec{};
                 const std::size_t bytes_written = co_await asio::async_write(socket, data, asio::redirect_error(asio::use_awaitable, ec));
@@ -137,14 +258,33 @@ namespace Brilliant
             }
 
             /**
-             * @brief Send data on the socket to the given endpoiont
+             * @brief Send data on the socket, completing through any asio completion token. Starts the
+             * write directly, without a coroutine frame
+             * @tparam ConstBufferSequence The buffer sequence type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param socket The socket
+             * @param data The data to send on the socket. Must stay valid until the send completes
+             * @param token Completed as void(error_code, std::size_t) with the first error and the number of bytes sent
+             * @return As given by the completion token
+             */
+            template<class ConstBufferSequence, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncSend(socket_type& socket, const ConstBufferSequence& data, CompletionToken&& token)
+                requires(!is_datagram_protocol_v<protocol_type> && asio::is_const_buffer_sequence<ConstBufferSequence>::value)
+            {
+                return asio::async_write(socket, data, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Send data on the socket to the given endpoiont. A buffer sequence is sent as a single datagram
+             * @tparam ConstBufferSequence The buffer sequence type
              * @param socket The socket
              * @param destination The remote endpoint 
              * @param data The data to send on the socket
              * @return The number of bytes written and the first error to occur if there was one
              */
-            asio::awaitable<std::pair<std::size_t, error_code>> Send(socket_type& socket, const endpoint_type& destination, const asio::const_buffer& data)
-                requires (is_datagram_protocol_v<protocol_type>)
+            template<class ConstBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> Send(socket_type& socket, const endpoint_type& destination, const ConstBufferSequence& data)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_const_buffer_sequence<ConstBufferSequence>::value)
             {
                 error_code ec{};
                 const std::size_t bytes_written = co_await socket.async_send_to(data, destination, asio::redirect_error(asio::use_awaitable, ec));
@@ -152,34 +292,444 @@ namespace Brilliant
             }
 
             /**
-             * @brief Read data from the given socket into a buffer
+             * @brief Send a datagram to the given endpoint, completing through any asio completion token
+             * @tparam ConstBufferSequence The buffer sequence type
+             * @tparam CompletionToken The completion token type
+             * @param socket The socket
+             * @param destination The remote endpoint. Must stay valid until the send completes
+             * @param data The data to send on the socket. Must stay valid until the send completes
+             * @param token Completed as void(error_code, std::size_t) with the error and the number of bytes sent
+             * @return As given by the completion token
+             */
+            template<class ConstBufferSequence, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncSend(socket_type& socket, const endpoint_type& destination, const ConstBufferSequence& data, CompletionToken&& token)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_const_buffer_sequence<ConstBufferSequence>::value)
+            {
+                return socket.async_send_to(data, destination, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Send a datagram on a connected socket. Skips the per send address lookup of
+             * sending to an endpoint, and the kernel can cache the route
+             * @tparam ConstBufferSequence The buffer sequence type
+             * @param socket The socket, connected to its peer
+             * @param data The data to send on the socket
+             * @return The number of bytes written and the first error to occur if there was one
+             */
+            template<class ConstBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> Send(socket_type& socket, const ConstBufferSequence& data)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_const_buffer_sequence<ConstBufferSequence>::value)
+            {
+                error_code ec{};
+                const std::size_t bytes_written = co_await socket.async_send(data, asio::redirect_error(asio::use_awaitable, ec));
+                co_return std::make_pair(bytes_written, ec);
+            }
+
+            /**
+             * @brief Send a datagram on a connected socket, completing through any asio completion token
+             * @tparam ConstBufferSequence The buffer sequence type
+             * @tparam CompletionToken The completion token type
+             * @param socket The socket, connected to its peer
+             * @param data The data to send on the socket. Must stay valid until the send completes
+             * @param token Completed as void(error_code, std::size_t) with the error and the number of bytes sent
+             * @return As given by the completion token
+             */
+            template<class ConstBufferSequence, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncSend(socket_type& socket, const ConstBufferSequence& data, CompletionToken&& token)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_const_buffer_sequence<ConstBufferSequence>::value)
+            {
+                return socket.async_send(data, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Read data from the given socket into a buffer. Buffer sequences are filled with scattered reads
+             * @tparam MutableBufferSequence The buffer sequence type, ie asio::mutable_buffer, std::array or std::vector of buffers
              * @param socket The socket
              * @param data A buffer to read into
              * @return The number of bytes read and the first error to occur if there was one
              */
-            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(socket_type& socket, const asio::mutable_buffer& data)
+            template<class MutableBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(socket_type& socket, const MutableBufferSequence& data)
+                requires (!is_datagram_protocol_v<protocol_type> && asio::is_mutable_buffer_sequence<MutableBufferSequence>::value)
+            {
+                error_code ec{};
+                if (read_buffer.Size() == 0)
+                {
+                    const std::size_t bytes_read = co_await asio::async_read(socket, data, asio::redirect_error(asio::use_awaitable, ec));
+                    co_return std::make_pair(bytes_read, ec);
+                }
+
+                //bytes already pulled in by ReadSome come first
+                std::size_t buffered = 0;
+                for (auto it = asio::buffer_sequence_begin(data); it != asio::buffer_sequence_end(data); ++it)
+                {
+                    buffered += read_buffer.Read(*it);
+                }
+
+                std::size_t bytes_read = 0;
+                if (buffered < asio::buffer_size(data))
+                {
+                    std::vector<asio::mutable_buffer> rest;
+                    std::size_t skip = buffered;
+                    for (auto it = asio::buffer_sequence_begin(data); it != asio::buffer_sequence_end(data); ++it)
+                    {
+                        asio::mutable_buffer buffer{ *it };
+                        const std::size_t n = std::min(skip, buffer.size());
+                        skip -= n;
+                        if (buffer.size() > n) { rest.push_back(buffer + n); }
+                    }
+                    bytes_read = co_await asio::async_read(socket, rest, asio::redirect_error(asio::use_awaitable, ec));
+                }
+                co_return std::make_pair(buffered + bytes_read, ec);
+            }
+
+            /**
+             * @brief Read data from the socket into a buffer, completing through any asio completion token.
+             * Starts the read directly, without a coroutine frame. Bytes already pulled in by ReadSome come first
+             * @tparam MutableBufferSequence The buffer sequence type
+             * @tparam CompletionToken The completion token type, ie a callback, asio::use_future or asio::use_awaitable
+             * @param socket The socket
+             * @param data A buffer to read into. Must stay valid until the read completes
+             * @param token Completed as void(error_code, std::size_t) with the first error and the number of bytes read
+             * @return As given by the completion token
+             */
+            template<class MutableBufferSequence, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncReadInto(socket_type& socket, const MutableBufferSequence& data, CompletionToken&& token)
+                requires (!is_datagram_protocol_v<protocol_type> && asio::is_mutable_buffer_sequence<MutableBufferSequence>::value)
+            {
+                //one initiation for both paths, so lazy tokens such as asio::deferred yield a single type
+                return asio::async_initiate<CompletionToken, void(error_code, std::size_t)>([this, &socket](auto handler, const MutableBufferSequence& data) {
+                    if (read_buffer.Size() == 0)
+                    {
+                        asio::async_read(socket, data, std::move(handler));
+                        return;
+                    }
+
+                    std::size_t buffered = 0;
+                    for (auto it = asio::buffer_sequence_begin(data); it != asio::buffer_sequence_end(data); ++it)
+                    {
+                        buffered += read_buffer.Read(*it);
+                    }
+
+                    auto executor = asio::get_associated_executor(handler, socket.get_executor());
+                    if (buffered == asio::buffer_size(data))
+                    {
+                        //never complete inline, the handler may start the next read
+                        asio::post(executor, [handler = std::move(handler), buffered]() mutable {
+                            std::move(handler)(error_code{}, buffered);
+                        });
+                        return;
+                    }
+
+                    std::vector<asio::mutable_buffer> rest;
+                    std::size_t skip = buffered;
+                    for (auto it = asio::buffer_sequence_begin(data); it != asio::buffer_sequence_end(data); ++it)
+                    {
+                        asio::mutable_buffer buffer{ *it };
+                        const std::size_t n = std::min(skip, buffer.size());
+                        skip -= n;
+                        if (buffer.size() > n) { rest.push_back(buffer + n); }
+                    }
+                    //keep the handler's cancellation slot, so per operation cancellation reaches the read
+                    auto slot = asio::get_associated_cancellation_slot(handler);
+                    asio::async_read(socket, std::move(rest), asio::bind_cancellation_slot(slot, asio::bind_executor(executor, [handler = std::move(handler), buffered](const error_code& ec, std::size_t bytes_read) mutable {
+                        std::move(handler)(ec, buffered + bytes_read);
+                    })));
+                }, token, data);
+            }
+
+            /**
+             * @brief Wait for datagrams then receive all that are available, up to one per buffer, 
+             * using as few system calls as possible
+             * @param socket The socket
+             * @param buffers One buffer per datagram. Each buffer is shrunk to the size of the datagram received into it
+             * @param sources Receives the source endpoint of each datagram. May be empty, otherwise at least as large as buffers
+             * @return The number of datagrams received and the first error to occur if there was one
+             */
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadBatch(socket_type& socket, std::span<asio::mutable_buffer> buffers, std::span<endpoint_type> sources)
+                requires (is_datagram_protocol_v<protocol_type>)
+            {
+                error_code ec{};
+                while (true)
+                {
+                    const std::size_t received = ReceiveDatagrams(socket, buffers, sources, ec);
+                    if (ec != asio::error::would_block)
+                    {
+                        co_return std::make_pair(received, ec);
+                    }
+
+                    co_await socket.async_wait(asio::socket_base::wait_read, asio::redirect_error(asio::use_awaitable, ec));
+                    if (ec) { co_return std::make_pair(std::size_t{ 0 }, ec); }
+                }
+            }
+
+            /**
+             * @brief Send datagrams using as few system calls as possible, waiting for the socket 
+             * to become writable as needed
+             * @param socket The socket
+             * @param buffers One buffer per datagram
+             * @param destinations The destination of each datagram, or a single destination for all of them
+             * @return The number of datagrams sent and the first error to occur if there was one
+             */
+            asio::awaitable<std::pair<std::size_t, error_code>> SendBatch(socket_type& socket, std::span<const asio::const_buffer> buffers, std::span<const endpoint_type> destinations)
+                requires (is_datagram_protocol_v<protocol_type>)
+            {
+                error_code ec{};
+                std::size_t sent = 0;
+                while (sent < buffers.size())
+                {
+                    const auto remaining_destinations = destinations.size() > 1 ? destinations.subspan(sent) : destinations;
+                    sent += SendDatagrams(socket, buffers.subspan(sent), remaining_destinations, ec);
+                    if (ec && ec != asio::error::would_block)
+                    {
+                        break;
+                    }
+
+                    if (sent < buffers.size())
+                    {
+                        co_await socket.async_wait(asio::socket_base::wait_write, asio::redirect_error(asio::use_awaitable, ec));
+                        if (ec) { break; }
+                    }
+                }
+                co_return std::make_pair(sent, ec);
+            }
+
+            /**
+             * @brief Read whatever is available from the socket, up to the free space of the
+             * connection's read buffer, with a single read. The returned view stays valid until
+             * the next call to ReadSome, ReadInto or Consume
+             * @param socket The socket
+             * @return Up to two buffers holding all unconsumed bytes and the first error to occur if there was one.
+             * Returns asio::error::no_buffer_space if the read buffer is full
+             */
+            asio::awaitable<std::pair<RingBuffer::const_buffers_type, error_code>> ReadSome(socket_type& socket)
                 requires (!is_datagram_protocol_v<protocol_type>)
             {
                 error_code ec{};
-                const std::size_t bytes_read = co_await asio::async_read(socket, data, asio::redirect_error(asio::use_awaitable, ec));
-                co_return std::make_pair(bytes_read, ec);
+                if (read_buffer.Full())
+                {
+                    co_return std::make_pair(read_buffer.Data(), error_code{ asio::error::no_buffer_space });
+                }
+
+                const std::size_t bytes_read = co_await socket.async_read_some(read_buffer.Prepare(), asio::redirect_error(asio::use_awaitable, ec));
+                read_buffer.Commit(bytes_read);
+                co_return std::make_pair(read_buffer.Data(), ec);
             }
 
             /**
-             * @brief Read data on the socket from the given endpoint into a buffer 
+             * @brief Discard bytes returned by ReadSome once they have been processed
+             * @param n The number of bytes to discard
+             */
+            void Consume(std::size_t n)
+            {
+                read_buffer.Consume(n);
+            }
+
+            /**
+             * @brief Set the capacity of the read buffer used by ReadSome
+             * @param capacity The capacity in bytes
+             * @return True if the capacity was changed, false if more bytes are buffered than would fit
+             */
+            bool SetReadBufferSize(std::size_t capacity)
+            {
+                return read_buffer.Resize(capacity);
+            }
+
+            /**
+             * @brief Read data on the socket from the given endpoint into a buffer. A buffer sequence
+             * receives a single datagram scattered across its buffers
+             * @tparam MutableBufferSequence The buffer sequence type
              * @param socket The socket
              * @param destination The remote endpoint
              * @param data A buffer to read into
              * @return The number of bytes read and the first error to occur if there was one 
              */
-            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(socket_type& socket, endpoint_type& destination, const asio::mutable_buffer& data)
-                requires (is_datagram_protocol_v<protocol_type>)
+            template<class MutableBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(socket_type& socket, endpoint_type& destination, const MutableBufferSequence& data)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_mutable_buffer_sequence<MutableBufferSequence>::value)
             {
                 error_code ec{};
                 const std::size_t bytes_read = co_await socket.async_receive_from(data, destination, asio::redirect_error(asio::use_awaitable, ec));
                 co_return std::make_pair(bytes_read, ec);
             }
 
+            /**
+             * @brief Read a datagram, completing through any asio completion token
+             * @tparam MutableBufferSequence The buffer sequence type
+             * @tparam CompletionToken The completion token type
+             * @param socket The socket
+             * @param destination Receives the source endpoint. Must stay valid until the read completes
+             * @param data A buffer to read into. Must stay valid until the read completes
+             * @param token Completed as void(error_code, std::size_t) with the error and the number of bytes read
+             * @return As given by the completion token
+             */
+            template<class MutableBufferSequence, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncReadInto(socket_type& socket, endpoint_type& destination, const MutableBufferSequence& data, CompletionToken&& token)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_mutable_buffer_sequence<MutableBufferSequence>::value)
+            {
+                return socket.async_receive_from(data, destination, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Read a datagram from the peer of a connected socket. The kernel drops datagrams
+             * from any other source
+             * @tparam MutableBufferSequence The buffer sequence type
+             * @param socket The socket, connected to its peer
+             * @param data A buffer to read into
+             * @return The number of bytes read and the first error to occur if there was one
+             */
+            template<class MutableBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(socket_type& socket, const MutableBufferSequence& data)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_mutable_buffer_sequence<MutableBufferSequence>::value)
+            {
+                error_code ec{};
+                const std::size_t bytes_read = co_await socket.async_receive(data, asio::redirect_error(asio::use_awaitable, ec));
+                co_return std::make_pair(bytes_read, ec);
+            }
+
+            /**
+             * @brief Read a datagram from the peer of a connected socket, completing through any asio completion token
+             * @tparam MutableBufferSequence The buffer sequence type
+             * @tparam CompletionToken The completion token type
+             * @param socket The socket, connected to its peer
+             * @param data A buffer to read into. Must stay valid until the read completes
+             * @param token Completed as void(error_code, std::size_t) with the error and the number of bytes read
+             * @return As given by the completion token
+             */
+            template<class MutableBufferSequence, asio::completion_token_for<void(error_code, std::size_t)> CompletionToken>
+            auto AsyncReadInto(socket_type& socket, const MutableBufferSequence& data, CompletionToken&& token)
+                requires (is_datagram_protocol_v<protocol_type> && asio::is_mutable_buffer_sequence<MutableBufferSequence>::value)
+            {
+                return socket.async_receive(data, std::forward<CompletionToken>(token));
+            }
+
+            /**
+             * @brief Send data as a run of equal sized datagrams. Uses udp segmentation offload where
+             * available, so the kernel or nic splits a large send into datagrams. Falls back to
+             * batched sends of each segment otherwise
+             * @tparam ConstBufferSequence The buffer sequence type
+             * @param socket The socket
+             * @param destination The remote endpoint
+             * @param data The data to send
+             * @param segment_size The datagram payload size, the last datagram may be shorter
+             * @return The number of bytes written and the first error to occur if there was one
+             */
+            template<class ConstBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> SendSegments(socket_type& socket, const endpoint_type& destination, const ConstBufferSequence& data, std::size_t segment_size)
+                requires (std::is_same_v<protocol_type, asio::ip::udp> && asio::is_const_buffer_sequence<ConstBufferSequence>::value)
+            {
+                const std::size_t total = asio::buffer_size(data);
+                if (segment_size == 0 || segment_size > max_gso_bytes)
+                {
+                    co_return std::make_pair(std::size_t{ 0 }, error_code{ asio::error::invalid_argument });
+                }
+
+                error_code ec{};
+                std::size_t sent = 0;
+                const std::vector<asio::const_buffer> buffers(asio::buffer_sequence_begin(data), asio::buffer_sequence_end(data));
+
+#ifdef BRILLIANT_NETWORK_HAS_UDP_GSO
+                if (!gso_unsupported)
+                {
+                    const std::size_t chunk = segment_size * std::clamp<std::size_t>(max_gso_bytes / segment_size, 1, max_gso_segments);
+                    std::vector<asio::const_buffer> slice;
+                    std::vector<char> gathered;
+                    while (sent < total)
+                    {
+                        SliceBuffers(buffers, sent, chunk, slice);
+                        if (slice.size() > max_gso_iovecs)
+                        {
+                            //too many pieces for one send, copy the chunk into one buffer
+                            gathered.resize(asio::buffer_size(slice));
+                            asio::buffer_copy(asio::buffer(gathered), slice);
+                            slice.assign(1, asio::buffer(gathered));
+                        }
+                        sent += SendSegmented(socket, &destination, slice, static_cast<std::uint16_t>(segment_size), ec);
+                        if (ec == asio::error::would_block)
+                        {
+                            co_await socket.async_wait(asio::socket_base::wait_write, asio::redirect_error(asio::use_awaitable, ec));
+                        }
+
+                        if (ec) { break; }
+                    }
+
+                    if (sent > 0 || (ec != asio::error::no_protocol_option && ec != asio::error::operation_not_supported && ec != asio::error::invalid_argument))
+                    {
+                        co_return std::make_pair(sent, ec);
+                    }
+
+                    //older kernels and some devices reject the option, remember that. Other rejections, ie a
+                    //segment larger than the path mtu, may pass next time, so only this send goes segment by segment
+                    if (ec != asio::error::invalid_argument)
+                    {
+                        gso_unsupported = true;
+                    }
+                    ec = {};
+                }
+#endif //BRILLIANT_NETWORK_HAS_UDP_GSO
+
+                //each datagram needs a contiguous buffer
+                std::vector<char> linear;
+                asio::const_buffer whole = buffers.empty() ? asio::const_buffer{} : buffers.front();
+                if (buffers.size() > 1)
+                {
+                    linear.resize(total);
+                    asio::buffer_copy(asio::buffer(linear), buffers);
+                    whole = asio::buffer(linear);
+                }
+
+                std::vector<asio::const_buffer> segments((total + segment_size - 1) / segment_size);
+                SplitSegments(whole, segment_size, segments);
+                auto [count, batch_ec] = co_await SendBatch(socket, segments, std::span<const endpoint_type>{ &destination, 1 });
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    sent += segments[i].size();
+                }
+                co_return std::make_pair(sent, batch_ec);
+            }
+
+            /**
+             * @brief Read a datagram, or a run of equal sized datagrams from the same sender coalesced
+             * by udp receive offload where available. The first call enables receive offload on the socket,
+             * after that all reads on the socket should go through ReadSegments
+             * @param socket The socket
+             * @param source Receives the remote endpoint
+             * @param data The buffer to read into, should be large enough for a coalesced read, ie 64KiB
+             * @param[out] segment_size The size of each datagram in data, the last may be shorter. Use
+             * SplitSegments to get the datagrams
+             * @return The number of bytes read and the first error to occur if there was one
+             */
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadSegments(socket_type& socket, endpoint_type& source, asio::mutable_buffer data, std::size_t& segment_size)
+                requires (std::is_same_v<protocol_type, asio::ip::udp>)
+            {
+                error_code ec{};
+#ifdef BRILLIANT_NETWORK_HAS_UDP_GSO
+                if (!gro_enabled)
+                {
+                    //without support reads are simply not coalesced
+                    error_code option_ec{};
+                    socket.set_option(udp_gro{ true }, option_ec);
+                    gro_enabled = true;
+                }
+
+                while (true)
+                {
+                    const std::size_t bytes_read = ReceiveCoalesced(socket, &source, data, segment_size, ec);
+                    if (ec != asio::error::would_block)
+                    {
+                        co_return std::make_pair(bytes_read, ec);
+                    }
+
+                    co_await socket.async_wait(asio::socket_base::wait_read, asio::redirect_error(asio::use_awaitable, ec));
+                    if (ec) { co_return std::make_pair(std::size_t{ 0 }, ec); }
+                }
+#else
+                const std::size_t bytes_read = co_await socket.async_receive_from(data, source, asio::redirect_error(asio::use_awaitable, ec));
+                segment_size = bytes_read;
+                co_return std::make_pair(bytes_read, ec);
+#endif //BRILLIANT_NETWORK_HAS_UDP_GSO
+            }
+
             /**
              * @brief Accept connections on the given socket using an acceptor
              * 
@@ -192,6 +742,25 @@ namespace Brilliant
                 co_await acceptor.async_accept(socket, asio::experimental::use_coro);
                 co_return error_code{};
             }
+
+        protected:
+            //! Buffer for streaming reads, bytes are kept here until consumed
+            RingBuffer read_buffer;
+
+            //! Set once udp receive offload has been requested on the socket
+            bool gro_enabled = false;
+
+            //! Set if the kernel rejected udp segmentation offload
+            bool gso_unsupported = false;
+
+            //! How Connect tries the resolved addresses
+            ConnectOptions connect_options;
+
+            //! Offers and stores tls sessions in Connect, null to always do a full handshake
+            SslSessionCache* session_cache = &SslSessionCache::Default();
+
+            //! Runs the server handshake off the socket's executor if set
+            HandshakePool* handshake_pool = nullptr;
         };
 
         //! Convenience alias for a tcp protocol
@@ -0,0 +1,232 @@
+/**
+ * @file ConnectionPool.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the ConnectionPool class template, a slab allocated object
+ * store with stable addresses and reuse of released slots
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @class ConnectionPool
+         * @brief Stores objects in fixed size slabs so that pointers handed out remain
+         * valid until the object is released. Released slots are kept on a free list
+         * and reused by the next acquire so memory stays flat under connection churn
+         * @tparam T The stored type
+         * @tparam SlabSize The number of objects allocated at a time
+         */
+        template<class T, std::size_t SlabSize = 64>
+        class ConnectionPool
+        {
+            static_assert(SlabSize > 0, "SlabSize must be greater than zero");
+
+        public:
+            using value_type = T;
+
+            ConnectionPool() = default;
+            ConnectionPool(const ConnectionPool&) = delete;
+            ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+            /**
+             * @brief Destroy the Connection Pool object and any objects still alive in it
+             *
+             */
+            ~ConnectionPool()
+            {
+                Clear();
+            }
+
+            /**
+             * @brief Construct an object in a free slot, allocating a new slab if there are none
+             *
+             * @tparam Args The constructor argument types
+             * @param args The constructor arguments
+             * @return A pointer to the new object which stays valid until it is released
+             */
+            template<class... Args>
+            T* Acquire(Args&&... args)
+            {
+                if (!free_list)
+                {
+                    Grow();
+                }
+
+                Slot* slot = free_list;
+                T* result = ::new (static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+                free_list = slot->next_free;
+                slot->next_free = nullptr;
+                slot->live = true;
+                ++slot->generation;
+                ++live_count;
+                return result;
+            }
+
+            /**
+             * @brief Destroy an object and return its slot to the free list
+             *
+             * @param item A pointer previously returned by Acquire. Null pointers are ignored
+             */
+            void Release(T* item)
+            {
+                if (!item) { return; }
+
+                Slot* slot = SlotOf(item);
+                if (!slot->live) { return; }
+
+                std::destroy_at(item);
+                slot->live = false;
+                slot->next_free = free_list;
+                free_list = slot;
+                --live_count;
+            }
+
+            /**
+             * @brief Get the generation of an object's slot, which changes each time the slot is reused.
+             * Lets work queued for an object check, with Holds, that the object was not released meanwhile
+             *
+             * @param item A pointer previously returned by Acquire and not yet released
+             * @return The generation
+             */
+            std::uint64_t Generation(const T* item) const
+            {
+                return SlotOf(item)->generation;
+            }
+
+            /**
+             * @brief Tells if a pointer still refers to the object it did when its generation was taken
+             *
+             * @param item A pointer previously returned by Acquire, released or not
+             * @param generation The generation of the slot when the pointer was live
+             * @return True if the object is live and its slot was not reused since
+             */
+            bool Holds(const T* item, std::uint64_t generation) const
+            {
+                const Slot* slot = SlotOf(item);
+                return slot->live && slot->generation == generation;
+            }
+
+            /**
+             * @brief Call a function on every live object
+             *
+             * @tparam F The function type
+             * @param f A function taking a T&
+             */
+            template<class F>
+            void ForEach(F&& f)
+            {
+                for (auto& slab : slabs)
+                {
+                    for (std::size_t i = 0; i < SlabSize; ++i)
+                    {
+                        if (slab[i].live)
+                        {
+                            f(*Get(slab[i]));
+                        }
+                    }
+                }
+            }
+
+            /**
+             * @brief Destroy all live objects. Allocated slabs are kept for reuse
+             *
+             */
+            void Clear()
+            {
+                for (auto& slab : slabs)
+                {
+                    for (std::size_t i = 0; i < SlabSize; ++i)
+                    {
+                        if (slab[i].live)
+                        {
+                            Release(Get(slab[i]));
+                        }
+                    }
+                }
+            }
+
+            /**
+             * @brief Get the number of live objects
+             *
+             * @return The number of live objects
+             */
+            std::size_t Size() const
+            {
+                return live_count;
+            }
+
+            /**
+             * @brief Get the number of slots allocated
+             *
+             * @return The number of allocated slots, live or free
+             */
+            std::size_t Capacity() const
+            {
+                return slabs.size() * SlabSize;
+            }
+
+        private:
+            //! A slot holding storage for a single object. storage must be the first member
+            struct Slot
+            {
+                alignas(T) std::byte storage[sizeof(T)];
+                Slot* next_free = nullptr;
+                std::uint64_t generation = 0;
+                bool live = false;
+            };
+
+            static T* Get(Slot& slot)
+            {
+                return std::launder(reinterpret_cast<T*>(slot.storage));
+            }
+
+            static Slot* SlotOf(T* item)
+            {
+                return reinterpret_cast<Slot*>(reinterpret_cast<std::byte*>(item));
+            }
+
+            static const Slot* SlotOf(const T* item)
+            {
+                return reinterpret_cast<const Slot*>(reinterpret_cast<const std::byte*>(item));
+            }
+
+            /**
+             * @brief Allocate a new slab and thread its slots onto the free list
+             *
+             */
+            void Grow()
+            {
+                auto& slab = slabs.emplace_back(std::make_unique<Slot[]>(SlabSize));
+                for (std::size_t i = SlabSize; i > 0; --i)
+                {
+                    slab[i - 1].next_free = free_list;
+                    free_list = &slab[i - 1];
+                }
+            }
+
+            //! Allocated slabs
+            std::vector<std::unique_ptr<Slot[]>> slabs;
+
+            //! Head of the list of free slots
+            Slot* free_list = nullptr;
+
+            //! The number of live objects
+            std::size_t live_count = 0;
+        };
+    }
+}
@@ -0,0 +1,214 @@
+/**
+ * @file DatagramBatch.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines functions which send and receive many datagrams per system call.
+ * Uses sendmmsg/recvmmsg on linux and falls back to a loop elsewhere
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <span>
+
+#include "AsioIncludes.h"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#define BRILLIANT_NETWORK_HAS_MMSG
+#endif //__linux__
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        //! The most datagrams passed to the kernel in one call
+        inline constexpr std::size_t max_datagram_batch = 64;
+
+        /**
+         * @brief Receive as many datagrams as are available without blocking
+         *
+         * @tparam Socket The datagram socket type
+         * @tparam Endpoint The endpoint type
+         * @param socket The socket
+         * @param buffers One buffer per datagram. Each buffer is shrunk to the size of the datagram received into it
+         * @param sources Receives the source endpoint of each datagram. May be empty, otherwise at least as large as buffers
+         * @param[out] ec Set to asio::error::would_block if nothing was available, or to any other error that occurred
+         * @return The number of datagrams received
+         */
+        template<class Socket, class Endpoint>
+        std::size_t ReceiveDatagrams(Socket& socket, std::span<asio::mutable_buffer> buffers, std::span<Endpoint> sources, error_code& ec)
+        {
+            ec = {};
+            std::size_t received = 0;
+
+#ifdef BRILLIANT_NETWORK_HAS_MMSG
+            std::array<mmsghdr, max_datagram_batch> headers{};
+            std::array<iovec, max_datagram_batch> iovecs{};
+            while (received < buffers.size())
+            {
+                const std::size_t count = std::min(max_datagram_batch, buffers.size() - received);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    auto& buffer = buffers[received + i];
+                    iovecs[i] = iovec{ buffer.data(), buffer.size() };
+                    headers[i] = mmsghdr{};
+                    headers[i].msg_hdr.msg_iov = &iovecs[i];
+                    headers[i].msg_hdr.msg_iovlen = 1;
+                    if (!sources.empty())
+                    {
+                        headers[i].msg_hdr.msg_name = sources[received + i].data();
+                        headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(sources[received + i].capacity());
+                    }
+                }
+
+                const int result = ::recvmmsg(socket.native_handle(), headers.data(), static_cast<unsigned int>(count), MSG_DONTWAIT, nullptr);
+                if (result < 0)
+                {
+                    if (received == 0)
+                    {
+                        ec = (errno == EAGAIN || errno == EWOULDBLOCK) ? error_code{ asio::error::would_block } : error_code{ errno, asio::error::get_system_category() };
+                    }
+                    break;
+                }
+
+                for (int i = 0; i < result; ++i)
+                {
+                    auto& buffer = buffers[received + i];
+                    buffer = asio::mutable_buffer{ buffer.data(), headers[i].msg_len };
+                    if (!sources.empty())
+                    {
+                        sources[received + i].resize(headers[i].msg_hdr.msg_namelen);
+                    }
+                }
+
+                received += static_cast<std::size_t>(result);
+                if (static_cast<std::size_t>(result) < count)
+                {
+                    break;
+                }
+            }
+#else
+            const bool was_non_blocking = socket.non_blocking();
+            socket.non_blocking(true, ec);
+            if (ec) { return 0; }
+
+            for (; received < buffers.size(); ++received)
+            {
+                Endpoint source{};
+                error_code receive_ec{};
+                const std::size_t size = socket.receive_from(buffers[received], source, 0, receive_ec);
+                if (receive_ec)
+                {
+                    if (received == 0) { ec = receive_ec; }
+                    break;
+                }
+
+                buffers[received] = asio::mutable_buffer{ buffers[received].data(), size };
+                if (!sources.empty()) { sources[received] = source; }
+            }
+
+            error_code restore_ec{};
+            socket.non_blocking(was_non_blocking, restore_ec);
+#endif //BRILLIANT_NETWORK_HAS_MMSG
+
+            return received;
+        }
+
+        /**
+         * @brief Send as many datagrams as the socket accepts without blocking
+         *
+         * @tparam Socket The datagram socket type
+         * @tparam Endpoint The endpoint type
+         * @param socket The socket
+         * @param buffers One buffer per datagram
+         * @param destinations The destination of each datagram, or a single destination for all of them.
+         * May be empty on a connected socket
+         * @param[out] ec Set to asio::error::would_block if nothing could be sent, or to any other error that occurred
+         * @return The number of datagrams sent
+         */
+        template<class Socket, class Endpoint>
+        std::size_t SendDatagrams(Socket& socket, std::span<const asio::const_buffer> buffers, std::span<const Endpoint> destinations, error_code& ec)
+        {
+            ec = {};
+            std::size_t sent = 0;
+
+            auto destination_of = [&destinations](std::size_t i) -> const Endpoint& {
+                return destinations.size() == 1 ? destinations[0] : destinations[i];
+            };
+
+#ifdef BRILLIANT_NETWORK_HAS_MMSG
+            std::array<mmsghdr, max_datagram_batch> headers{};
+            std::array<iovec, max_datagram_batch> iovecs{};
+            while (sent < buffers.size())
+            {
+                const std::size_t count = std::min(max_datagram_batch, buffers.size() - sent);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    const auto& buffer = buffers[sent + i];
+                    iovecs[i] = iovec{ const_cast<void*>(buffer.data()), buffer.size() };
+                    headers[i] = mmsghdr{};
+                    headers[i].msg_hdr.msg_iov = &iovecs[i];
+                    headers[i].msg_hdr.msg_iovlen = 1;
+                    if (!destinations.empty())
+                    {
+                        const auto& destination = destination_of(sent + i);
+                        headers[i].msg_hdr.msg_name = const_cast<void*>(static_cast<const void*>(destination.data()));
+                        headers[i].msg_hdr.msg_namelen = static_cast<socklen_t>(destination.size());
+                    }
+                }
+
+                const int result = ::sendmmsg(socket.native_handle(), headers.data(), static_cast<unsigned int>(count), MSG_DONTWAIT);
+                if (result < 0)
+                {
+                    if (sent == 0)
+                    {
+                        ec = (errno == EAGAIN || errno == EWOULDBLOCK) ? error_code{ asio::error::would_block } : error_code{ errno, asio::error::get_system_category() };
+                    }
+                    break;
+                }
+
+                sent += static_cast<std::size_t>(result);
+                if (static_cast<std::size_t>(result) < count)
+                {
+                    break;
+                }
+            }
+#else
+            const bool was_non_blocking = socket.non_blocking();
+            socket.non_blocking(true, ec);
+            if (ec) { return 0; }
+
+            for (; sent < buffers.size(); ++sent)
+            {
+                error_code send_ec{};
+                if (destinations.empty())
+                {
+                    socket.send(buffers[sent], 0, send_ec);
+                }
+                else
+                {
+                    socket.send_to(buffers[sent], destination_of(sent), 0, send_ec);
+                }
+
+                if (send_ec)
+                {
+                    if (sent == 0) { ec = send_ec; }
+                    break;
+                }
+            }
+
+            error_code restore_ec{};
+            socket.non_blocking(was_non_blocking, restore_ec);
+#endif //BRILLIANT_NETWORK_HAS_MMSG
+
+            return sent;
+        }
+    }
+}
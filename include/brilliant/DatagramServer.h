@@ -0,0 +1,887 @@
+/**
+ * @file DatagramServer.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the DatagramServer and DatagramPeer class templates, which
+ * serve many peers on one datagram socket with a virtual connection per peer
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "AsioIncludes.h"
+#include "ConnectionPool.h"
+#include "DatagramBatch.h"
+#include "EndpointHelper.h"
+#include "SocketOptions.h"
+#include "SocketTraits.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @struct DatagramServerOptions
+         * @brief Limits and timing for a DatagramServer
+         */
+        struct DatagramServerOptions
+        {
+            //! Peers with no traffic for this long are evicted. Zero disables eviction
+            std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(60);
+
+            //! The most bytes queued for a peer. Datagrams arriving while the queue is full are dropped
+            std::size_t max_queued_bytes = 256 * 1024;
+
+            //! The largest datagram received, larger datagrams are truncated
+            std::size_t max_datagram_size = 64 * 1024;
+
+            //! The most datagrams received per system call
+            std::size_t batch_size = 16;
+
+            //! The most peers in the endpoint table. Datagrams from new sources are dropped while it is full,
+            //! so a flood of spoofed sources cannot exhaust memory or, with connect_peers, file descriptors.
+            //! Zero means no limit
+            std::size_t max_peers = 4096;
+
+            //! The most new peers waiting for Accept. Datagrams from new sources are dropped while that many
+            //! wait. Zero means no limit
+            std::size_t max_pending = 128;
+
+            //! Give each new peer its own socket bound to the server port with SO_REUSEPORT and connected
+            //! to the peer. The kernel then routes the peer's datagrams straight to that socket and caches
+            //! the route for sends. Only has an effect where BRILLIANT_NETWORK_HAS_REUSE_PORT is defined.
+            //! Peer activity is then counted when the peer reads or sends
+            bool connect_peers = false;
+        };
+
+        /**
+         * @struct EndpointHash
+         * @brief Hashes the address and port of an endpoint, or the raw bytes of endpoints without an address
+         */
+        struct EndpointHash
+        {
+            template<class Endpoint>
+            std::size_t operator()(const Endpoint& endpoint) const
+            {
+                if constexpr (requires { endpoint.address(); endpoint.port(); })
+                {
+                    std::size_t hash{};
+                    const auto address = endpoint.address();
+                    if (address.is_v4())
+                    {
+                        hash = std::hash<std::uint32_t>{}(address.to_v4().to_uint());
+                    }
+                    else
+                    {
+                        const auto bytes = address.to_v6().to_bytes();
+                        hash = std::hash<std::string_view>{}(std::string_view{ reinterpret_cast<const char*>(bytes.data()), bytes.size() });
+                    }
+                    return hash ^ (std::hash<unsigned short>{}(endpoint.port()) + 0x9e3779b9 + (hash << 6) + (hash >> 2));
+                }
+                else
+                {
+                    return std::hash<std::string_view>{}(std::string_view{ reinterpret_cast<const char*>(endpoint.data()), endpoint.size() });
+                }
+            }
+        };
+
+        template<class Protocol>
+        class DatagramServer;
+
+        /**
+         * @class DatagramPeer
+         * @brief A virtual connection to one peer of a DatagramServer. Datagrams from the peer are
+         * queued by the server and read with ReadInto, sends go to the peer through the server socket, or
+         * through the peer's own connected socket if the server connects peers. All use of a peer must be
+         * on the server's executor
+         * @tparam Protocol The protocol implementation type
+         */
+        template<class Protocol>
+        class DatagramPeer
+        {
+        public:
+            using protocol_type = Protocol;
+            using endpoint_type = typename protocol_type::endpoint_type;
+            using server_type = DatagramServer<protocol_type>;
+
+            /**
+             * @brief Construct a new Datagram Peer object
+             *
+             * @param server The server the peer belongs to
+             * @param remote The peer endpoint
+             */
+            DatagramPeer(server_type& server, const endpoint_type& remote) :
+                server(&server),
+                remote_endpoint(remote),
+                timer(server.get_executor()),
+                last_active(std::chrono::steady_clock::now())
+            {
+
+            }
+
+            DatagramPeer(const DatagramPeer&) = delete;
+            DatagramPeer& operator=(const DatagramPeer&) = delete;
+
+            /**
+             * @brief Destroy the Datagram Peer object. A read still pending returns the close reason
+             * without touching the peer again
+             *
+             */
+            ~DatagramPeer()
+            {
+                Close(asio::error::not_connected);
+                if (pending_read)
+                {
+                    pending_read->orphaned = true;
+                    pending_read->reason = close_reason;
+                }
+            }
+
+            /**
+             * @brief Send data to the peer
+             *
+             * @tparam T The message type
+             * @param data The message
+             * @return The number of bytes written and the first error to occur if there was one
+             */
+            template<class T>
+            asio::awaitable<std::pair<std::size_t, error_code>> Send(T&& data)
+            {
+                if (closed)
+                {
+                    co_return std::make_pair(std::size_t{ 0 }, close_reason);
+                }
+
+                last_active = std::chrono::steady_clock::now();
+                if (connected_socket)
+                {
+                    co_return co_await server->impl.Send(*connected_socket, std::forward<T>(data));
+                }
+                co_return co_await server->impl.Send(server->socket, remote_endpoint, std::forward<T>(data));
+            }
+
+            /**
+             * @brief Read the next datagram from the peer, waiting for one if none are queued.
+             * A datagram larger than data is truncated
+             *
+             * @tparam MutableBufferSequence The buffer sequence type
+             * @param data The buffer to read into
+             * @return The number of bytes read and the first error to occur if there was one. Queued
+             * datagrams are still returned after the peer was closed, then the reason it was closed, ie
+             * asio::error::timed_out if it was evicted for being idle
+             */
+            template<class MutableBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(const MutableBufferSequence& data)
+                requires (asio::is_mutable_buffer_sequence<MutableBufferSequence>::value)
+            {
+                //woken by Deliver and Close. The peer may be released or destroyed while the read waits,
+                //the frame keeps what the read needs to return then
+                error_code ec{};
+                PendingRead wait{};
+                while (queue.empty())
+                {
+                    if (closed)
+                    {
+                        co_return std::make_pair(std::size_t{ 0 }, close_reason);
+                    }
+
+                    pending_read = &wait;
+                    if (connected_socket)
+                    {
+                        //datagrams still in flight to the server socket when the peer socket was connected
+                        //are queued, Deliver cancels this read so they are not stuck behind it
+                        reading = true;
+                        auto [bytes_read, read_ec] = co_await server->impl.ReadInto(*connected_socket, data);
+                        if (wait.orphaned)
+                        {
+                            co_return std::make_pair(std::size_t{ 0 }, wait.reason);
+                        }
+
+                        reading = false;
+                        pending_read = nullptr;
+                        if (release_on_wake)
+                        {
+                            co_return std::make_pair(std::size_t{ 0 }, ReleaseNow());
+                        }
+
+                        if (read_ec == asio::error::operation_aborted)
+                        {
+                            continue;
+                        }
+
+                        last_active = std::chrono::steady_clock::now();
+                        co_return std::make_pair(bytes_read, read_ec);
+                    }
+
+                    timer.expires_at(asio::steady_timer::time_point::max());
+                    co_await timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                    if (wait.orphaned)
+                    {
+                        co_return std::make_pair(std::size_t{ 0 }, wait.reason);
+                    }
+
+                    pending_read = nullptr;
+                    if (release_on_wake)
+                    {
+                        co_return std::make_pair(std::size_t{ 0 }, ReleaseNow());
+                    }
+                }
+
+                auto datagram = std::move(queue.front());
+                queue.pop_front();
+                queued_bytes -= datagram.size();
+
+                const std::size_t bytes_read = asio::buffer_copy(data, asio::buffer(datagram));
+                server->Recycle(std::move(datagram));
+                co_return std::make_pair(bytes_read, error_code{});
+            }
+
+            /**
+             * @brief Close the virtual connection. Pending and later reads return asio::error::not_connected
+             * once the queue is drained. The server socket stays open
+             *
+             * @return Always an empty error_code, to match AwaitableConnection
+             */
+            error_code Disconnect()
+            {
+                Close(asio::error::not_connected);
+                return {};
+            }
+
+            /**
+             * @brief Tells if the virtual connection is active
+             *
+             * @return True if the peer has not been closed or evicted
+             */
+            bool IsConnected() const
+            {
+                return !closed;
+            }
+
+            /**
+             * @brief Get the peer endpoint
+             *
+             * @return The peer endpoint
+             */
+            const endpoint_type& GetRemoteEndpoint() const
+            {
+                return remote_endpoint;
+            }
+
+            /**
+             * @brief Get the number of datagrams dropped because the peer's queue was full
+             *
+             * @return The number of dropped datagrams
+             */
+            std::size_t Dropped() const
+            {
+                return dropped;
+            }
+
+            /**
+             * @brief Get the executor of the server socket. Coroutines using the peer should be spawned on it
+             *
+             * @return The executor
+             */
+            auto get_executor()
+            {
+                return server->get_executor();
+            }
+
+        private:
+            friend server_type;
+
+            /**
+             * @brief Queue a datagram received from the peer and wake a pending read
+             *
+             * @param datagram The datagram, moved from unless it was dropped
+             * @param max_queued_bytes The queue limit
+             * @return False if the datagram was dropped
+             */
+            bool Deliver(std::vector<char>& datagram, std::size_t max_queued_bytes)
+            {
+                last_active = std::chrono::steady_clock::now();
+                if (closed || queued_bytes + datagram.size() > max_queued_bytes)
+                {
+                    ++dropped;
+                    return false;
+                }
+
+                queued_bytes += datagram.size();
+                queue.push_back(std::move(datagram));
+                timer.cancel();
+                if (reading)
+                {
+                    error_code ec{};
+                    connected_socket->cancel(ec);
+                }
+                return true;
+            }
+
+            /**
+             * @brief Mark the peer closed and wake a pending read
+             *
+             * @param reason The error reads report once the queue is drained
+             */
+            void Close(error_code reason)
+            {
+                if (closed) { return; }
+
+                closed = true;
+                close_reason = reason;
+                timer.cancel();
+                if (connected_socket)
+                {
+                    //stops the kernel routing the peer's datagrams to this socket
+                    error_code ec{};
+                    connected_socket->close(ec);
+                }
+            }
+
+            /**
+             * @brief Return the peer's storage to the server, for a Release deferred until the pending read woke.
+             * The peer must not be touched after this call
+             *
+             * @return The reason the peer was closed
+             */
+            error_code ReleaseNow()
+            {
+                const error_code reason = close_reason;
+                server->peers.Release(this);
+                return reason;
+            }
+
+            //! Lives in the frame of a pending read, so the read can finish after the peer is gone
+            struct PendingRead
+            {
+                //! Set if the peer was destroyed while the read was pending
+                bool orphaned = false;
+
+                //! The reason the peer was closed, returned by an orphaned read
+                error_code reason{};
+            };
+
+            //! The server the peer belongs to
+            server_type* server;
+
+            //! The peer endpoint
+            endpoint_type remote_endpoint;
+
+            //! Wakes a pending read, used as a condition variable
+            asio::steady_timer timer;
+
+            //! The peer's own socket, connected to it, if the server connects peers
+            std::optional<typename protocol_type::socket_type> connected_socket;
+
+            //! Set while a read on the connected socket is pending
+            bool reading = false;
+
+            //! Datagrams received from the peer and not yet read
+            std::deque<std::vector<char>> queue;
+
+            //! The total size of queued datagrams
+            std::size_t queued_bytes = 0;
+
+            //! The number of datagrams dropped because the queue was full
+            std::size_t dropped = 0;
+
+            //! The time of the last datagram sent to or received from the peer
+            std::chrono::steady_clock::time_point last_active;
+
+            //! Set once the peer is closed or evicted
+            bool closed = false;
+
+            //! The error reported by reads once the peer is closed
+            error_code close_reason{};
+
+            //! Set once the peer has been returned by Accept
+            bool accepted = false;
+
+            //! Set while the peer is in the server's endpoint table
+            bool mapped = true;
+
+            //! The read waiting for a datagram, if there is one
+            PendingRead* pending_read = nullptr;
+
+            //! Set if the peer was released while a read was pending. The read frees the peer once it wakes
+            bool release_on_wake = false;
+        };
+
+        /**
+         * @class DatagramServer
+         * @brief Serves many peers on a single datagram socket. Received datagrams are demultiplexed
+         * by source endpoint into a DatagramPeer per peer, each with its own receive queue. New peers are
+         * returned by Accept and peers with no traffic for the idle timeout are evicted. The server and
+         * its peers must be used from the executor the server was constructed with
+         * @tparam Protocol The protocol implementation type
+         */
+        template<class Protocol>
+        class DatagramServer
+        {
+        public:
+            using protocol_type = Protocol;
+            using base_protocol_type = typename Protocol::protocol_type;
+            using socket_type = typename protocol_type::socket_type;
+            using endpoint_type = typename protocol_type::endpoint_type;
+            using peer_type = DatagramPeer<protocol_type>;
+
+            static_assert(is_datagram_protocol_v<base_protocol_type>, "DatagramServer requires a datagram protocol");
+
+            /**
+             * @brief Construct a new Datagram Server object
+             *
+             * @param e The executor for the socket and the coroutines spawned by the server
+             * @param options Limits and timing
+             */
+            DatagramServer(asio::any_io_executor e, DatagramServerOptions options = {}) :
+                executor(e),
+                options(options),
+                socket(e),
+                accept_timer(e),
+                sweep_timer(e),
+                receive_timer(e)
+            {
+
+            }
+
+            DatagramServer(const DatagramServer&) = delete;
+            DatagramServer& operator=(const DatagramServer&) = delete;
+
+            /**
+             * @brief Destroy the Datagram Server object
+             *
+             */
+            ~DatagramServer()
+            {
+                *alive = false;
+                Disconnect();
+            }
+
+            /**
+             * @brief Bind to the given service and start receiving
+             *
+             * @param service The service to listen on as a string
+             * @param bind_options Options applied to the socket before it is bound
+             * @return The first error to occur if there was one
+             */
+            error_code Listen(std::string_view service, AcceptorOptions bind_options = {})
+            {
+                error_code ec{};
+                auto ep = MakeEndpointFromService<protocol_type>(service, ec);
+                if (ec) { return ec; }
+
+                socket.open(ep.protocol(), ec);
+                if (ec) { return ec; }
+
+#ifdef BRILLIANT_NETWORK_HAS_REUSE_PORT
+                //peer sockets share the port
+                bind_options.reuse_port = bind_options.reuse_port || options.connect_peers;
+#endif //BRILLIANT_NETWORK_HAS_REUSE_PORT
+
+                ApplyBindOptions(socket, bind_options, ec);
+                if (!ec)
+                {
+                    socket.bind(ep, ec);
+                }
+
+                if (!ec)
+                {
+                    local_endpoint = socket.local_endpoint(ec);
+                }
+
+                if (ec)
+                {
+                    error_code close_ec{};
+                    socket.close(close_ec);
+                    return ec;
+                }
+
+                asio::co_spawn(executor, Receive(alive), asio::detached);
+                if (options.idle_timeout.count() > 0)
+                {
+                    asio::co_spawn(executor, Sweep(alive), asio::detached);
+                }
+                return ec;
+            }
+
+            /**
+             * @brief Wait for a datagram from a new peer
+             *
+             * @return The new peer, or nullptr once the server is disconnected
+             */
+            asio::awaitable<peer_type*> Accept()
+            {
+                error_code ec{};
+                while (pending.empty())
+                {
+                    if (!socket.is_open())
+                    {
+                        co_return nullptr;
+                    }
+
+                    accept_timer.expires_at(asio::steady_timer::time_point::max());
+                    co_await accept_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                }
+
+                auto* peer = pending.front();
+                pending.pop_front();
+                peer->accepted = true;
+                co_return peer;
+            }
+
+            /**
+             * @brief Close a peer and return its storage to the server for reuse. The pointer must not
+             * be used after this call. A later datagram from the same endpoint makes a new peer
+             *
+             * @param peer A peer previously returned by Accept
+             */
+            void Release(peer_type* peer)
+            {
+                if (!peer) { return; }
+
+                peer->Close(asio::error::not_connected);
+                Unmap(peer);
+
+                //Close woke the pending read, the peer is freed when it resumes
+                if (peer->pending_read)
+                {
+                    peer->release_on_wake = true;
+                    return;
+                }
+                peers.Release(peer);
+            }
+
+            /**
+             * @brief Close the socket and all peers
+             *
+             */
+            void Disconnect()
+            {
+                error_code ec{};
+                socket.close(ec);
+                accept_timer.cancel();
+                sweep_timer.cancel();
+                receive_timer.cancel();
+
+                peers.ForEach([](peer_type& peer) {
+                    peer.Close(asio::error::not_connected);
+                });
+            }
+
+            /**
+             * @brief Get the number of peers in the endpoint table
+             *
+             * @return The number of peers
+             */
+            std::size_t PeerCount() const
+            {
+                return by_endpoint.size();
+            }
+
+            /**
+             * @brief Get the number of datagrams from new sources dropped because max_peers or max_pending was reached
+             *
+             * @return The number of rejected datagrams
+             */
+            std::size_t Rejected() const
+            {
+                return rejected;
+            }
+
+            /**
+             * @brief Get the local endpoint of the server socket
+             *
+             * @param[out] ec Set if the endpoint could not be retrieved
+             * @return The local endpoint
+             */
+            endpoint_type GetLocalEndpoint(error_code& ec) const
+            {
+                return socket.local_endpoint(ec);
+            }
+
+            /**
+             * @brief Get the executor object
+             *
+             * @return The executor
+             */
+            auto get_executor()
+            {
+                return executor;
+            }
+
+        private:
+            friend peer_type;
+
+            /**
+             * @brief Receive datagrams in batches and hand each to the peer it came from. Errors the socket
+             * cannot recover from disconnect the server, others are retried after a growing delay. Only waits
+             * are awaited, so a completion already queued when the server is destroyed checks alive before
+             * touching it
+             *
+             * @param alive Cleared when the server is destroyed
+             */
+            asio::awaitable<void> Receive(std::shared_ptr<bool> alive)
+            {
+                const std::size_t batch = std::max<std::size_t>(options.batch_size, 1);
+                std::vector<char> storage(batch * options.max_datagram_size);
+                std::vector<asio::mutable_buffer> buffers(batch);
+                std::vector<endpoint_type> sources(batch);
+                std::chrono::milliseconds backoff{ 0 };
+
+                while (socket.is_open())
+                {
+                    for (std::size_t i = 0; i < batch; ++i)
+                    {
+                        buffers[i] = asio::buffer(storage.data() + i * options.max_datagram_size, options.max_datagram_size);
+                    }
+
+                    error_code ec{};
+                    const std::size_t count = ReceiveDatagrams(socket, std::span<asio::mutable_buffer>{ buffers }, std::span<endpoint_type>{ sources }, ec);
+                    if (ec == asio::error::would_block)
+                    {
+                        co_await socket.async_wait(asio::socket_base::wait_read, asio::redirect_error(asio::use_awaitable, ec));
+                        if (!*alive) { co_return; }
+                        if (!ec) { continue; }
+                    }
+
+                    if (ec == asio::error::operation_aborted || ec == asio::error::bad_descriptor)
+                    {
+                        co_return;
+                    }
+
+                    if (ec == asio::error::not_socket || ec == asio::error::invalid_argument || ec == asio::error::fault)
+                    {
+                        Disconnect();
+                        co_return;
+                    }
+
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        Dispatch(sources[i], buffers[i]);
+                    }
+
+                    if (!ec || count > 0)
+                    {
+                        backoff = std::chrono::milliseconds(0);
+                        continue;
+                    }
+
+                    //ie no buffer space, wait before retrying rather than spinning on the error
+                    backoff = std::clamp(backoff * 2, std::chrono::milliseconds(1), max_receive_backoff);
+                    receive_timer.expires_after(backoff);
+                    co_await receive_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                    if (!*alive || ec) { co_return; }
+                }
+            }
+
+            /**
+             * @brief Queue a datagram on the peer it came from, creating the peer if it is new and the
+             * peer limits allow it
+             *
+             * @param source The datagram source
+             * @param data The datagram
+             */
+            void Dispatch(const endpoint_type& source, asio::const_buffer data)
+            {
+                auto it = by_endpoint.find(source);
+                if (it == by_endpoint.end())
+                {
+                    //sources are not verified, each new one costs a peer and perhaps a socket
+                    if ((options.max_peers > 0 && by_endpoint.size() >= options.max_peers) ||
+                        (options.max_pending > 0 && pending.size() >= options.max_pending))
+                    {
+                        ++rejected;
+                        return;
+                    }
+
+                    auto* peer = peers.Acquire(*this, source);
+                    if (options.connect_peers)
+                    {
+                        ConnectPeer(*peer);
+                    }
+                    it = by_endpoint.emplace(source, peer).first;
+                    pending.push_back(peer);
+                    accept_timer.cancel();
+                }
+
+                auto datagram = TakeBuffer();
+                datagram.assign(static_cast<const char*>(data.data()), static_cast<const char*>(data.data()) + data.size());
+                if (!it->second->Deliver(datagram, options.max_queued_bytes))
+                {
+                    Recycle(std::move(datagram));
+                }
+            }
+
+            /**
+             * @brief Open a socket for a new peer on the server port and connect it to the peer.
+             * If that fails the peer keeps using the server socket
+             *
+             * @param peer The peer
+             */
+            void ConnectPeer([[maybe_unused]] peer_type& peer)
+            {
+#ifdef BRILLIANT_NETWORK_HAS_REUSE_PORT
+                error_code ec{};
+                socket_type peer_socket{ executor };
+                peer_socket.open(local_endpoint.protocol(), ec);
+                if (ec) { return; }
+
+                peer_socket.set_option(asio::socket_base::reuse_address{ true }, ec);
+                if (ec) { return; }
+
+                peer_socket.set_option(reuse_port{ true }, ec);
+                if (ec) { return; }
+
+                peer_socket.bind(local_endpoint, ec);
+                if (ec) { return; }
+
+                peer_socket.connect(peer.remote_endpoint, ec);
+                if (ec) { return; }
+
+                peer.connected_socket.emplace(std::move(peer_socket));
+#endif //BRILLIANT_NETWORK_HAS_REUSE_PORT
+            }
+
+            /**
+             * @brief Evict peers which have been idle for the idle timeout. Peers which were never
+             * accepted are released, accepted peers are closed and wait for Release
+             *
+             * @param alive Cleared when the server is destroyed, checked before the server is touched after a wait
+             */
+            asio::awaitable<void> Sweep(std::shared_ptr<bool> alive)
+            {
+                error_code ec{};
+                while (socket.is_open())
+                {
+                    sweep_timer.expires_after(std::max<std::chrono::steady_clock::duration>(options.idle_timeout / 2, std::chrono::milliseconds(1)));
+                    co_await sweep_timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                    if (!*alive || ec) { co_return; }
+
+                    const auto now = std::chrono::steady_clock::now();
+                    for (auto it = by_endpoint.begin(); it != by_endpoint.end();)
+                    {
+                        auto* peer = it->second;
+                        if (now - peer->last_active < options.idle_timeout)
+                        {
+                            ++it;
+                            continue;
+                        }
+
+                        it = by_endpoint.erase(it);
+                        peer->mapped = false;
+                        peer->Close(asio::error::timed_out);
+                        if (!peer->accepted)
+                        {
+                            pending.erase(std::find(pending.begin(), pending.end(), peer));
+                            peers.Release(peer);
+                        }
+                    }
+                }
+            }
+
+            /**
+             * @brief Remove a peer from the endpoint table
+             *
+             * @param peer The peer
+             */
+            void Unmap(peer_type* peer)
+            {
+                if (!peer->mapped) { return; }
+
+                by_endpoint.erase(peer->remote_endpoint);
+                peer->mapped = false;
+            }
+
+            /**
+             * @brief Get a buffer for a received datagram, reusing one returned by a read if possible
+             *
+             * @return An empty buffer
+             */
+            std::vector<char> TakeBuffer()
+            {
+                if (spare.empty()) { return {}; }
+
+                auto buffer = std::move(spare.back());
+                spare.pop_back();
+                return buffer;
+            }
+
+            /**
+             * @brief Keep a datagram buffer for reuse
+             *
+             * @param buffer The buffer
+             */
+            void Recycle(std::vector<char>&& buffer)
+            {
+                if (spare.size() < max_spare_buffers)
+                {
+                    buffer.clear();
+                    spare.push_back(std::move(buffer));
+                }
+            }
+
+            //! The most datagram buffers kept for reuse
+            static constexpr std::size_t max_spare_buffers = 1024;
+
+            //! The longest wait before retrying a receive that failed
+            static constexpr std::chrono::milliseconds max_receive_backoff{ 1000 };
+
+            //! The asio executor used for the socket and coroutines
+            asio::any_io_executor executor;
+
+            //! Limits and timing
+            DatagramServerOptions options;
+
+            //! The protocol implementation, used for batched receives and sends
+            protocol_type impl;
+
+            //! The socket shared by all peers
+            socket_type socket;
+
+            //! The endpoint the socket is bound to, peer sockets bind to it too
+            endpoint_type local_endpoint;
+
+            //! Wakes a pending Accept, used as a condition variable
+            asio::steady_timer accept_timer;
+
+            //! Wakes the idle sweep
+            asio::steady_timer sweep_timer;
+
+            //! Delays the retry of a failed receive
+            asio::steady_timer receive_timer;
+
+            //! Peer storage. Addresses are stable until released
+            ConnectionPool<peer_type> peers;
+
+            //! Maps a source endpoint to its peer
+            std::unordered_map<endpoint_type, peer_type*, EndpointHash> by_endpoint;
+
+            //! New peers not yet returned by Accept
+            std::deque<peer_type*> pending;
+
+            //! Datagram buffers kept for reuse
+            std::vector<std::vector<char>> spare;
+
+            //! The number of datagrams from new sources dropped by the peer limits
+            std::size_t rejected = 0;
+
+            //! Cleared when the server is destroyed, so completions already queued for its coroutines do not touch it
+            std::shared_ptr<bool> alive = std::make_shared<bool>(true);
+        };
+    }
+}
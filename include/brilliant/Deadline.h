@@ -0,0 +1,159 @@
+/**
+ * @file Deadline.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the Deadline class, a timer which runs an action if an
+ * operation takes too long
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "AsioIncludes.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @class Deadline
+         * @brief Runs an action, ie cancelling a socket, if not stopped before a timeout. Can be started
+         * again once stopped. An expiry already queued when the deadline is stopped or restarted is ignored.
+         * Not thread safe, start and stop it from the executor the action runs on. When that executor is run by
+         * more than one thread it must be a strand, or the action races the code it interrupts
+         */
+        class Deadline
+        {
+        public:
+            /**
+             * @brief Construct a new Deadline object
+             *
+             * @param exec The executor the action runs on
+             */
+            explicit Deadline(asio::any_io_executor exec) :
+                state(std::make_shared<State>(exec))
+            {
+
+            }
+
+            Deadline(const Deadline&) = delete;
+            Deadline& operator=(const Deadline&) = delete;
+            Deadline(Deadline&&) noexcept = default;
+
+            Deadline& operator=(Deadline&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    Stop();
+                    state = std::move(other.state);
+                }
+                return *this;
+            }
+
+            /**
+             * @brief Destroy the Deadline object. The action will not run
+             *
+             */
+            ~Deadline()
+            {
+                Stop();
+            }
+
+            /**
+             * @brief Start the deadline, replacing any running one. The action runs on the executor the deadline
+             * was made with
+             *
+             * @tparam Action Callable as action()
+             * @param timeout How long until the action runs. Not started if zero or less
+             * @param action Runs if the deadline is not stopped in time
+             */
+            template<class Action>
+            void Start(std::chrono::steady_clock::duration timeout, Action action)
+            {
+                Start(timeout, state->timer.get_executor(), std::move(action));
+            }
+
+            /**
+             * @brief Start the deadline, replacing any running one, running the action on the given executor. Use
+             * the executor of the coroutine the action interrupts, ie one emitting a cancellation signal bound to
+             * that coroutine's operation, as signals are not thread safe
+             *
+             * @tparam Executor The executor type
+             * @tparam Action Callable as action()
+             * @param timeout How long until the action runs. Not started if zero or less
+             * @param exec The executor the action, and the check that the deadline was not stopped, run on
+             * @param action Runs if the deadline is not stopped in time
+             */
+            template<class Executor, class Action>
+            void Start(std::chrono::steady_clock::duration timeout, const Executor& exec, Action action)
+            {
+                Stop();
+                state->expired = false;
+                if (timeout.count() <= 0) { return; }
+
+                state->timer.expires_after(timeout);
+                state->timer.async_wait(asio::bind_executor(exec, [state = state, generation = state->generation, action = std::move(action)](const error_code& ec) mutable {
+                    if (ec || generation != state->generation) { return; }
+
+                    state->expired = true;
+                    action();
+                }));
+            }
+
+            /**
+             * @brief Stop the deadline so the action does not run
+             *
+             */
+            void Stop()
+            {
+                if (!state) { return; }
+
+                ++state->generation;
+                state->timer.cancel();
+            }
+
+            /**
+             * @brief Tells if the action ran since the deadline was last started
+             *
+             * @return True if the deadline expired
+             */
+            bool Expired() const
+            {
+                return state && state->expired;
+            }
+
+        private:
+            /**
+             * @struct State
+             * @brief Shared with the pending wait so it can outlive the Deadline
+             */
+            struct State
+            {
+                explicit State(asio::any_io_executor exec) :
+                    timer(exec)
+                {
+
+                }
+
+                //! Expires at the deadline
+                asio::steady_timer timer;
+
+                //! Bumped by Stop so a queued expiry from an earlier start is ignored
+                std::uint64_t generation = 0;
+
+                //! Set when the action runs
+                bool expired = false;
+            };
+
+            //! The timer and its bookkeeping
+            std::shared_ptr<State> state;
+        };
+    }
+}
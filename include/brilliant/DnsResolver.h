@@ -0,0 +1,610 @@
+/**
+ * @file DnsResolver.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the DnsResolver class, an asynchronous stub resolver which
+ * sends its queries with UdpProtocol, and DnsResolvePolicy for ResolveEndpoints
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "AsioIncludes.h"
+#include "BasicProtocol.h"
+#include "EndpointHelper.h"
+#include "ResolverCache.h"
+
+#include <openssl/rand.h>
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @struct DnsResolverOptions
+         * @brief Name servers, timing and static host entries for a DnsResolver
+         */
+        struct DnsResolverOptions
+        {
+            //! The name servers, tried in order
+            std::vector<asio::ip::udp::endpoint> servers;
+
+            //! How long to wait for a name server to answer
+            std::chrono::milliseconds timeout{ 5000 };
+
+            //! The number of passes over the name servers before giving up
+            int attempts = 2;
+
+            //! Static host entries by lower case name, checked before any query is sent
+            std::unordered_map<std::string, std::vector<asio::ip::address>> hosts;
+
+            /**
+             * @brief Read the system configuration. Reads nameserver lines and the timeout and attempts
+             * options of resolv.conf, and the entries of the hosts file. Uses 127.0.0.1 if no name server
+             * is configured
+             *
+             * @param resolv_conf The path of resolv.conf
+             * @param hosts_file The path of the hosts file
+             * @return The options
+             */
+            static DnsResolverOptions FromSystem(const std::string& resolv_conf = "/etc/resolv.conf", const std::string& hosts_file = "/etc/hosts")
+            {
+                DnsResolverOptions options{};
+
+                std::ifstream conf{ resolv_conf };
+                for (std::string line; std::getline(conf, line);)
+                {
+                    std::istringstream words{ line.substr(0, line.find_first_of("#;")) };
+                    std::string keyword;
+                    words >> keyword;
+                    if (keyword == "nameserver")
+                    {
+                        std::string server;
+                        words >> server;
+                        error_code ec{};
+                        auto address = asio::ip::make_address(server, ec);
+                        if (!ec)
+                        {
+                            options.servers.emplace_back(address, 53);
+                        }
+                    }
+                    else if (keyword == "options")
+                    {
+                        for (std::string option; words >> option;)
+                        {
+                            const auto colon = option.find(':');
+                            if (colon == std::string::npos) { continue; }
+
+                            int value{};
+                            const auto number = std::string_view{ option }.substr(colon + 1);
+                            if (std::from_chars(number.data(), number.data() + number.size(), value).ec != std::errc{}) { continue; }
+
+                            if (option.starts_with("timeout:"))
+                            {
+                                options.timeout = std::chrono::seconds(std::max(value, 1));
+                            }
+                            else if (option.starts_with("attempts:"))
+                            {
+                                options.attempts = std::max(value, 1);
+                            }
+                        }
+                    }
+                }
+
+                if (options.servers.empty())
+                {
+                    options.servers.emplace_back(asio::ip::address_v4::loopback(), 53);
+                }
+
+                std::ifstream hosts{ hosts_file };
+                for (std::string line; std::getline(hosts, line);)
+                {
+                    std::istringstream words{ line.substr(0, line.find('#')) };
+                    std::string field;
+                    if (!(words >> field)) { continue; }
+
+                    error_code ec{};
+                    auto address = asio::ip::make_address(field, ec);
+                    if (ec) { continue; }
+
+                    while (words >> field)
+                    {
+                        options.hosts[ToLower(field)].push_back(address);
+                    }
+                }
+
+                return options;
+            }
+
+            /**
+             * @brief Lower case a name
+             *
+             * @param name The name
+             * @return The lower case name
+             */
+            static std::string ToLower(std::string_view name)
+            {
+                std::string lower{ name };
+                std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                return lower;
+            }
+        };
+
+        /**
+         * @class DnsResolver
+         * @brief Resolves names without blocking a thread. Numeric hosts and static host entries are
+         * answered directly, other names with A and AAAA queries sent over UdpProtocol to the configured
+         * name servers, retrying on timeout. Answers truncated to fit a datagram are asked again over
+         * TcpProtocol. Each lookup uses its own socket, so any number can run at
+         * once on one io_context. Search domains are not applied and services must be numeric ports.
+         * Safe to share between threads
+         */
+        class DnsResolver
+        {
+        public:
+            /**
+             * @brief Construct a new Dns Resolver object
+             *
+             * @param options Name servers, timing and static host entries
+             */
+            explicit DnsResolver(DnsResolverOptions options = DnsResolverOptions::FromSystem()) :
+                options(std::move(options))
+            {
+
+            }
+
+            /**
+             * @brief Get the resolver shared by the whole process, configured from the system. Used by DnsResolvePolicy
+             *
+             * @return The shared resolver
+             */
+            static DnsResolver& Default()
+            {
+                static DnsResolver resolver;
+                return resolver;
+            }
+
+            /**
+             * @brief Resolve a host and service
+             *
+             * @tparam InternetProtocol The asio protocol type, ie asio::ip::tcp
+             * @param exec The executor for the query socket
+             * @param host The host name or address
+             * @param service The port number as a string
+             * @param[out] ec Set if the lookup failed. asio::error::host_not_found if the name does not
+             * exist, asio::error::host_not_found_try_again if no name server answered
+             * @return The resolved endpoints, IPv6 first
+             */
+            template<class InternetProtocol>
+            asio::awaitable<typename asio::ip::basic_resolver<InternetProtocol>::results_type>
+                Resolve(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec)
+            {
+                std::chrono::steady_clock::duration ttl = std::chrono::steady_clock::duration::max();
+                co_return co_await Resolve<InternetProtocol>(exec, host, service, ec, ttl);
+            }
+
+            /**
+             * @brief Resolve a host and service, reporting how long the result may be cached
+             *
+             * @tparam InternetProtocol The asio protocol type, ie asio::ip::tcp
+             * @param exec The executor for the query socket
+             * @param host The host name or address
+             * @param service The port number as a string
+             * @param[out] ec Set if the lookup failed
+             * @param[in,out] ttl Lowered to the smallest ttl of the records found
+             * @return The resolved endpoints, IPv6 first
+             */
+            template<class InternetProtocol>
+            asio::awaitable<typename asio::ip::basic_resolver<InternetProtocol>::results_type>
+                Resolve(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec, std::chrono::steady_clock::duration& ttl)
+            {
+                using results_type = typename asio::ip::basic_resolver<InternetProtocol>::results_type;
+                using endpoint_type = typename InternetProtocol::endpoint;
+
+                ec = {};
+                std::uint16_t port{};
+                if (std::from_chars(service.data(), service.data() + service.size(), port).ec != std::errc{})
+                {
+                    ec = asio::error::service_not_found;
+                    co_return results_type{};
+                }
+
+                std::vector<asio::ip::address> addresses;
+                error_code parse_ec{};
+                if (auto address = asio::ip::make_address(std::string{ host }, parse_ec); !parse_ec)
+                {
+                    addresses.push_back(address);
+                }
+                else
+                {
+                    auto name = DnsResolverOptions::ToLower(host);
+                    if (!name.empty() && name.back() == '.') { name.pop_back(); }
+
+                    if (auto it = options.hosts.find(name); it != options.hosts.end())
+                    {
+                        addresses = it->second;
+                    }
+                    else
+                    {
+                        addresses = co_await Query(exec, name, ec, ttl);
+                        if (ec) { co_return results_type{}; }
+                    }
+                }
+
+                std::vector<endpoint_type> endpoints;
+                for (const auto& address : addresses)
+                {
+                    endpoints.emplace_back(address, port);
+                }
+                co_return results_type::create(endpoints.begin(), endpoints.end(), std::string{ host }, std::string{ service });
+            }
+
+        private:
+            //! The record types queried
+            static constexpr std::uint16_t type_a = 1, type_aaaa = 28;
+
+            //! The largest answer read, answers over udp are at most 512 bytes without EDNS. Larger
+            //! answers come truncated and are asked again over tcp
+            static constexpr std::size_t max_message_size = 512;
+
+            /**
+             * @brief Send A and AAAA queries for a name, trying each name server in turn until one answers both
+             *
+             * @param exec The executor for the query socket
+             * @param name The lower case name
+             * @param[out] ec Set if the lookup failed
+             * @param[in,out] ttl Lowered to the smallest ttl of the records found
+             * @return The addresses found, IPv6 first
+             */
+            asio::awaitable<std::vector<asio::ip::address>> Query(asio::any_io_executor exec, const std::string& name, error_code& ec, std::chrono::steady_clock::duration& ttl)
+            {
+                std::array<std::uint8_t, max_message_size> query_a{}, query_aaaa{};
+
+                //one byte spare, to tell a datagram over the limit from one which fits
+                std::array<std::uint8_t, max_message_size + 1> response{};
+                const std::uint16_t id_a = NextId(), id_aaaa = NextId();
+                const std::size_t size_a = EncodeQuery(id_a, name, type_a, query_a, ec);
+                const std::size_t size_aaaa = EncodeQuery(id_aaaa, name, type_aaaa, query_aaaa, ec);
+                if (ec) { co_return std::vector<asio::ip::address>{}; }
+
+                UdpProtocol udp{};
+                std::shared_ptr<asio::ip::udp::socket> socket;
+                asio::steady_timer timer{ exec };
+
+                for (int attempt = 0; attempt < options.attempts; ++attempt)
+                {
+                    for (const auto& server : options.servers)
+                    {
+                        //a fresh socket per attempt, so a late timeout from the last attempt cannot cancel this
+                        //one's read, and each attempt gets a new source port
+                        error_code socket_ec{};
+                        socket = std::make_shared<asio::ip::udp::socket>(exec);
+                        socket->open(server.protocol(), socket_ec);
+                        if (socket_ec) { continue; }
+
+                        //ie the server is unreachable, try the next one
+                        socket_ec = (co_await udp.Send(*socket, server, asio::buffer(query_a.data(), size_a))).second;
+                        if (!socket_ec)
+                        {
+                            socket_ec = (co_await udp.Send(*socket, server, asio::buffer(query_aaaa.data(), size_aaaa))).second;
+                        }
+                        if (socket_ec) { continue; }
+
+                        //closes the read below if the server does not answer in time
+                        timer.expires_after(options.timeout);
+                        timer.async_wait([weak = std::weak_ptr<asio::ip::udp::socket>{ socket }](error_code timer_ec) {
+                            if (auto expired = weak.lock(); expired && !timer_ec)
+                            {
+                                expired->cancel(timer_ec);
+                            }
+                        });
+
+                        std::vector<asio::ip::address> v4, v6;
+                        bool done_a = false, done_aaaa = false, refused = false, missing = false;
+                        std::uint32_t min_ttl = std::numeric_limits<std::uint32_t>::max();
+                        while (!(done_a && done_aaaa) && !refused)
+                        {
+                            //timed out, or an error the next server may not have
+                            asio::ip::udp::endpoint from{};
+                            auto [size, read_ec] = co_await udp.ReadInto(*socket, from, asio::buffer(response));
+                            if (read_ec) { break; }
+                            if (from != server) { continue; }
+
+                            int rcode{};
+                            bool truncated = size > max_message_size, answered = true;
+                            if (!done_a && ParseResponse(response.data(), size, id_a, v4, min_ttl, rcode, truncated))
+                            {
+                                if (truncated)
+                                {
+                                    answered = co_await QueryTcp(exec, server, asio::buffer(query_a.data(), size_a), id_a, v4, min_ttl, rcode);
+                                }
+                                done_a = answered;
+                            }
+                            else if (!done_aaaa && ParseResponse(response.data(), size, id_aaaa, v6, min_ttl, rcode, truncated))
+                            {
+                                if (truncated)
+                                {
+                                    answered = co_await QueryTcp(exec, server, asio::buffer(query_aaaa.data(), size_aaaa), id_aaaa, v6, min_ttl, rcode);
+                                }
+                                done_aaaa = answered;
+                            }
+                            else
+                            {
+                                continue;
+                            }
+
+                            //the timer only cancels a pending read, one expiring during the tcp query is checked here
+                            if (!answered || (truncated && std::chrono::steady_clock::now() >= timer.expiry()))
+                            {
+                                break;
+                            }
+
+                            missing = missing || rcode == 3;
+                            refused = rcode != 0 && rcode != 3;
+                        }
+                        timer.cancel();
+
+                        if (done_a && done_aaaa)
+                        {
+                            if (v4.empty() && v6.empty())
+                            {
+                                ec = asio::error::host_not_found;
+                                co_return std::vector<asio::ip::address>{};
+                            }
+
+                            ttl = std::min<std::chrono::steady_clock::duration>(ttl, std::chrono::seconds(min_ttl));
+                            v6.insert(v6.end(), v4.begin(), v4.end());
+                            co_return v6;
+                        }
+
+                        if (missing)
+                        {
+                            //the name does not exist, another server will not say otherwise
+                            ec = asio::error::host_not_found;
+                            co_return std::vector<asio::ip::address>{};
+                        }
+                    }
+                }
+
+                ec = asio::error::host_not_found_try_again;
+                co_return std::vector<asio::ip::address>{};
+            }
+
+            /**
+             * @brief Ask a name server again over tcp, for an answer truncated to fit a datagram
+             *
+             * @param exec The executor for the query socket
+             * @param server The name server
+             * @param query The query
+             * @param id The query id
+             * @param[out] addresses Receives the addresses found
+             * @param[in,out] ttl Lowered to the smallest ttl of the records found
+             * @param[out] rcode The response code
+             * @return True if a complete answer was read
+             */
+            asio::awaitable<bool> QueryTcp(asio::any_io_executor exec, const asio::ip::udp::endpoint& server, asio::const_buffer query, std::uint16_t id, std::vector<asio::ip::address>& addresses, std::uint32_t& ttl, int& rcode)
+            {
+                TcpProtocol tcp{};
+                auto socket = std::make_shared<asio::ip::tcp::socket>(exec);
+                asio::steady_timer timer{ exec };
+
+                //closes the socket if the server does not answer in time, so every later step fails
+                timer.expires_after(options.timeout);
+                timer.async_wait([weak = std::weak_ptr<asio::ip::tcp::socket>{ socket }](error_code timer_ec) {
+                    if (auto expired = weak.lock(); expired && !timer_ec)
+                    {
+                        expired->close(timer_ec);
+                    }
+                });
+
+                //messages over tcp are prefixed with their size
+                error_code ec{};
+                std::array<std::uint8_t, 2> prefix{ static_cast<std::uint8_t>(query.size() >> 8), static_cast<std::uint8_t>(query.size()) };
+                co_await socket->async_connect({ server.address(), server.port() }, asio::redirect_error(asio::use_awaitable, ec));
+                if (!ec)
+                {
+                    ec = (co_await tcp.Send(*socket, std::array<asio::const_buffer, 2>{ asio::buffer(prefix), query })).second;
+                }
+
+                if (!ec)
+                {
+                    ec = (co_await tcp.ReadInto(*socket, asio::buffer(prefix))).second;
+                }
+
+                std::vector<std::uint8_t> response(ec ? 0 : (prefix[0] << 8) | prefix[1]);
+                if (!ec)
+                {
+                    ec = (co_await tcp.ReadInto(*socket, asio::buffer(response))).second;
+                }
+                timer.cancel();
+
+                bool truncated = false;
+                co_return !ec && ParseResponse(response.data(), response.size(), id, addresses, ttl, rcode, truncated) && !truncated;
+            }
+
+            /**
+             * @brief Get a random query id from a cryptographic source, so answers are hard to forge
+             *
+             * @return The id
+             */
+            static std::uint16_t NextId()
+            {
+                std::array<unsigned char, 2> bytes{};
+                if (RAND_bytes(bytes.data(), static_cast<int>(bytes.size())) != 1)
+                {
+                    return static_cast<std::uint16_t>(std::random_device{}());
+                }
+                return static_cast<std::uint16_t>((bytes[0] << 8) | bytes[1]);
+            }
+
+            /**
+             * @brief Encode a recursive query for one record type
+             *
+             * @param id The query id
+             * @param name The name
+             * @param type The record type
+             * @param out The message storage
+             * @param[out] ec Set to asio::error::invalid_argument if the name is not a valid dns name
+             * @return The message size
+             */
+            static std::size_t EncodeQuery(std::uint16_t id, std::string_view name, std::uint16_t type, std::array<std::uint8_t, max_message_size>& out, error_code& ec)
+            {
+                if (name.empty() || name.size() > 253)
+                {
+                    ec = asio::error::invalid_argument;
+                    return 0;
+                }
+
+                //id, recursion desired, one question
+                const std::array<std::uint8_t, 12> header{ static_cast<std::uint8_t>(id >> 8), static_cast<std::uint8_t>(id), 0x01, 0x00, 0x00, 0x01 };
+                std::size_t size = std::copy(header.begin(), header.end(), out.begin()) - out.begin();
+
+                while (!name.empty())
+                {
+                    const auto label = name.substr(0, name.find('.'));
+                    if (label.empty() || label.size() > 63)
+                    {
+                        ec = asio::error::invalid_argument;
+                        return 0;
+                    }
+
+                    out[size++] = static_cast<std::uint8_t>(label.size());
+                    size = std::copy(label.begin(), label.end(), out.begin() + size) - out.begin();
+                    name.remove_prefix(std::min(name.size(), label.size() + 1));
+                }
+
+                const std::array<std::uint8_t, 5> footer{ 0x00, static_cast<std::uint8_t>(type >> 8), static_cast<std::uint8_t>(type), 0x00, 0x01 };
+                return std::copy(footer.begin(), footer.end(), out.begin() + size) - out.begin();
+            }
+
+            /**
+             * @brief Parse an answer, collecting the addresses of its A and AAAA records
+             *
+             * @param data The message
+             * @param size The message size
+             * @param id The id of the query answered
+             * @param[out] addresses Receives the addresses found
+             * @param[in,out] ttl Lowered to the smallest ttl of the records found
+             * @param[out] rcode The response code, 0 for success and 3 if the name does not exist
+             * @param[in,out] truncated Set if the answer did not fit the message, or passed in set if the message
+             * was cut short when it was read. No addresses are taken from a truncated answer
+             * @return False if the message is not a well formed answer to the query
+             */
+            static bool ParseResponse(const std::uint8_t* data, std::size_t size, std::uint16_t id, std::vector<asio::ip::address>& addresses, std::uint32_t& ttl, int& rcode, bool& truncated)
+            {
+                auto read16 = [data](std::size_t at) { return static_cast<std::uint16_t>((data[at] << 8) | data[at + 1]); };
+                auto skip_name = [data, size](std::size_t& at) {
+                    while (at < size)
+                    {
+                        const std::uint8_t length = data[at];
+                        if (length == 0) { at += 1; return true; }
+                        if ((length & 0xc0) == 0xc0) { at += 2; return at <= size; }
+                        at += length + 1;
+                    }
+                    return false;
+                };
+
+                if (size < 12 || read16(0) != id || !(data[2] & 0x80))
+                {
+                    return false;
+                }
+
+                rcode = data[3] & 0x0f;
+                truncated = truncated || (data[2] & 0x02) != 0;
+                if (truncated) { return true; }
+
+                const std::uint16_t questions = read16(4), answers = read16(6);
+                std::size_t at = 12;
+                for (std::uint16_t i = 0; i < questions; ++i)
+                {
+                    if (!skip_name(at) || at + 4 > size) { return false; }
+                    at += 4;
+                }
+
+                std::vector<asio::ip::address> found;
+                for (std::uint16_t i = 0; i < answers; ++i)
+                {
+                    if (!skip_name(at) || at + 10 > size) { return false; }
+
+                    const std::uint16_t type = read16(at), record_class = read16(at + 2), length = read16(at + 8);
+                    const std::uint32_t record_ttl = (std::uint32_t{ read16(at + 4) } << 16) | read16(at + 6);
+                    at += 10;
+                    if (at + length > size) { return false; }
+
+                    if (record_class == 1 && type == type_a && length == 4)
+                    {
+                        asio::ip::address_v4::bytes_type bytes{};
+                        std::copy(data + at, data + at + 4, bytes.begin());
+                        found.emplace_back(asio::ip::address_v4{ bytes });
+                        ttl = std::min(ttl, record_ttl);
+                    }
+                    else if (record_class == 1 && type == type_aaaa && length == 16)
+                    {
+                        asio::ip::address_v6::bytes_type bytes{};
+                        std::copy(data + at, data + at + 16, bytes.begin());
+                        found.emplace_back(asio::ip::address_v6{ bytes });
+                        ttl = std::min(ttl, record_ttl);
+                    }
+                    at += length;
+                }
+
+                addresses.insert(addresses.end(), found.begin(), found.end());
+                return true;
+            }
+
+            //! Name servers, timing and static host entries. Not changed after construction
+            DnsResolverOptions options;
+        };
+
+        /**
+         * @struct DnsResolvePolicy
+         * @brief Resolves with the shared DnsResolver through a ResolverCache of its own, which keeps
+         * results for the ttl of the records found. Pass to ResolveEndpoints, or define
+         * BRILLIANT_NETWORK_USE_DNS_RESOLVER to make it the default
+         */
+        struct DnsResolvePolicy
+        {
+            template<class InternetProtocol>
+            static asio::awaitable<typename asio::ip::basic_resolver<InternetProtocol>::results_type>
+                Resolve(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec)
+            {
+                return Cache<InternetProtocol>().Resolve(exec, host, service, ec,
+                    [](asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec, std::chrono::steady_clock::duration& ttl) {
+                        return DnsResolver::Default().Resolve<InternetProtocol>(exec, host, service, ec, ttl);
+                    });
+            }
+
+            /**
+             * @brief Get the cache of DnsResolver results for a protocol
+             *
+             * @tparam InternetProtocol The asio protocol type
+             * @return The cache
+             */
+            template<class InternetProtocol>
+            static ResolverCache<InternetProtocol>& Cache()
+            {
+                static ResolverCache<InternetProtocol> cache;
+                return cache;
+            }
+        };
+    }
+}
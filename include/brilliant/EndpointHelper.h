@@ -14,6 +14,7 @@
 #include <charconv>
 
 #include "AsioIncludes.h"
+#include "ResolverCache.h"
 #include "SocketTraits.h"
 
 namespace Brilliant
@@ -58,33 +59,62 @@ namespace Brilliant
         }
 
         /**
-         * @brief Resolve endpoints from host and service strings
+         * @struct SystemResolvePolicy
+         * @brief Resolves with the system resolver, asio's getaddrinfo on a background thread, through
+         * the shared ResolverCache of the protocol
+         */
+        struct SystemResolvePolicy
+        {
+            template<class InternetProtocol>
+            static asio::awaitable<typename asio::ip::basic_resolver<InternetProtocol>::results_type>
+                Resolve(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec)
+            {
+                return ResolverCache<InternetProtocol>::Default().Resolve(exec, host, service, ec);
+            }
+        };
+
+        //! Resolves with DnsResolver, see DnsResolver.h
+        struct DnsResolvePolicy;
+
+#ifdef BRILLIANT_NETWORK_USE_DNS_RESOLVER
+        //! The policy ResolveEndpoints uses unless given one
+        using DefaultResolvePolicy = DnsResolvePolicy;
+#else
+        //! The policy ResolveEndpoints uses unless given one
+        using DefaultResolvePolicy = SystemResolvePolicy;
+#endif //BRILLIANT_NETWORK_USE_DNS_RESOLVER
+
+        /**
+         * @brief Resolve endpoints from host and service strings. By default results come from the shared
+         * ResolverCache of the protocol, so repeated connects to the same host skip the resolver. Define
+         * BRILLIANT_NETWORK_USE_DNS_RESOLVER to resolve with DnsResolver everywhere instead
          * 
          * @tparam Protocol The asio protocol type
+         * @tparam ResolvePolicy Does the resolution, ie SystemResolvePolicy or DnsResolvePolicy
          * @param exec The asio executor for the resolver
          * @param host The host as a string
          * @param service The service as a string
          * @param[out] ec An error_code that an error will be stored in if they occur
          */
-        template<class Protocol>
+        template<class Protocol, class ResolvePolicy = DefaultResolvePolicy>
         asio::awaitable<typename Protocol::resolver_type::results_type>
             ResolveEndpoints(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec)
             requires (!is_local_protocol_v<typename Protocol::protocol_type>)
         {
-            typename Protocol::resolver_type resolver(exec);
-            co_return co_await resolver.async_resolve(host, service, asio::redirect_error(asio::use_awaitable, ec));
+            return ResolvePolicy::template Resolve<typename Protocol::protocol_type>(exec, host, service, ec);
         }
 
         /**
          * @brief Resolve endpoints from host and service strings
          * 
          * @tparam Protocol The asio protocol type
+         * @tparam ResolvePolicy Unused, local endpoints are never looked up
          * @param exec The asio executor for the resolver
          * @param host The host as a string
          * @param service The service as a string
          * @param[out] ec An error_code that errors will be stored in if they occur
          */
-        template<class Protocol>
+        template<class Protocol, class ResolvePolicy = DefaultResolvePolicy>
         asio::awaitable<typename Protocol::resolver_type::results_type>
             ResolveEndpoints(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec)
             requires(is_local_protocol_v<typename Protocol::protocol_type>)
@@ -0,0 +1,289 @@
+/**
+ * @file FramedProtocol.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines a protocol adapter which sends and receives length prefixed
+ * messages over a stream protocol
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "AsioIncludes.h"
+#include "BasicProtocol.h"
+#include "SocketTraits.h"
+#include "RingBuffer.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @enum LengthPrefix
+         * @brief The encoding of the length in front of each frame
+         */
+        enum class LengthPrefix
+        {
+            Varint, //!< Unsigned LEB128, 1 to 10 bytes
+            Fixed32 //!< 4 byte big endian unsigned integer
+        };
+
+        /**
+         * @struct FramedProtocol
+         * @brief Adapts a stream protocol to send and receive length prefixed frames. Can be used as
+         * the Protocol of AwaitableServer, AwaitableClient and AwaitableConnection. ReadInto fills a
+         * vector with views of every complete frame in the receive buffer, the views stay valid until
+         * the next read
+         * @tparam Base The stream protocol implementation, ie TcpProtocol or SslProtocol
+         * @tparam Prefix The length prefix encoding
+         */
+        template<class Base, LengthPrefix Prefix = LengthPrefix::Varint>
+        struct FramedProtocol : Base
+        {
+            static_assert(!is_datagram_protocol_v<typename Base::protocol_type>, "FramedProtocol requires a stream protocol");
+
+            using base_type = Base;
+            using frames_type = std::vector<asio::const_buffer>;
+
+            //! The largest header a frame can have
+            static constexpr std::size_t max_header_size = Prefix == LengthPrefix::Varint ? 10 : 4;
+
+            /**
+             * @brief Encode a frame header
+             *
+             * @param size The payload size
+             * @param out Storage for at least max_header_size bytes
+             * @return The number of header bytes written, zero if the size does not fit the prefix
+             */
+            static std::size_t EncodeHeader(std::size_t size, char* out)
+            {
+                if constexpr (Prefix == LengthPrefix::Varint)
+                {
+                    std::size_t n = 0;
+                    do
+                    {
+                        auto byte = static_cast<std::uint8_t>(size & 0x7f);
+                        size >>= 7;
+                        out[n++] = static_cast<char>(size ? byte | 0x80 : byte);
+                    } while (size);
+                    return n;
+                }
+                else
+                {
+                    if (size > UINT32_MAX) { return 0; }
+
+                    const auto value = static_cast<std::uint32_t>(size);
+                    out[0] = static_cast<char>(value >> 24);
+                    out[1] = static_cast<char>(value >> 16);
+                    out[2] = static_cast<char>(value >> 8);
+                    out[3] = static_cast<char>(value);
+                    return 4;
+                }
+            }
+
+            /**
+             * @brief Send a payload as one frame. The header and payload go out in one gathered write
+             *
+             * @tparam ConstBufferSequence The payload buffer sequence type
+             * @param socket The socket
+             * @param payload The frame payload
+             * @return The number of payload bytes sent and the first error to occur if there was one.
+             * Returns asio::error::message_size if the payload is larger than the max frame size
+             */
+            template<class ConstBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> Send(typename Base::socket_type& socket, const ConstBufferSequence& payload)
+                requires (asio::is_const_buffer_sequence<ConstBufferSequence>::value)
+            {
+                const std::size_t size = asio::buffer_size(payload);
+                if (size > max_frame_size)
+                {
+                    co_return std::make_pair(std::size_t{ 0 }, error_code{ asio::error::message_size });
+                }
+
+                std::array<char, max_header_size> header{};
+                const std::size_t header_size = EncodeHeader(size, header.data());
+                if (header_size == 0)
+                {
+                    co_return std::make_pair(std::size_t{ 0 }, error_code{ asio::error::message_size });
+                }
+
+                std::pair<std::size_t, error_code> result{};
+                if constexpr (std::is_convertible_v<ConstBufferSequence, asio::const_buffer>)
+                {
+                    const std::array<asio::const_buffer, 2> frame{ asio::buffer(header.data(), header_size), asio::const_buffer{ payload } };
+                    result = co_await Base::Send(socket, frame);
+                }
+                else
+                {
+                    std::vector<asio::const_buffer> frame{ asio::buffer(header.data(), header_size) };
+                    frame.insert(frame.end(), asio::buffer_sequence_begin(payload), asio::buffer_sequence_end(payload));
+                    result = co_await Base::Send(socket, frame);
+                }
+
+                result.first = result.first > header_size ? result.first - header_size : 0;
+                co_return result;
+            }
+
+            /**
+             * @brief Read at least one frame. Every complete frame already received is returned, so one
+             * read from the socket can yield many frames
+             *
+             * @param socket The socket
+             * @param[out] frames Cleared, then filled with views of the received frame payloads. The views
+             * point into the receive buffer and stay valid until the next read or Consume
+             * @return The number of frames and the first error to occur if there was one. Returns
+             * asio::error::message_size if a frame is larger than the max frame size
+             */
+            asio::awaitable<std::pair<std::size_t, error_code>> ReadInto(typename Base::socket_type& socket, frames_type& frames)
+            {
+                frames.clear();
+
+                //frames handed out by the last read are done with now
+                Base::Consume(delivered);
+                delivered = 0;
+
+                while (true)
+                {
+                    const auto data = this->read_buffer.Linearize();
+                    const char* begin = static_cast<const char*>(data.data());
+                    std::size_t offset = 0;
+
+                    while (true)
+                    {
+                        std::size_t size{}, header_size{};
+                        if (!DecodeHeader(begin + offset, data.size() - offset, size, header_size))
+                        {
+                            break;
+                        }
+
+                        if (header_size == 0 || size > max_frame_size)
+                        {
+                            co_return std::make_pair(std::size_t{ 0 }, error_code{ asio::error::message_size });
+                        }
+
+                        if (data.size() - offset - header_size < size)
+                        {
+                            break;
+                        }
+
+                        frames.emplace_back(begin + offset + header_size, size);
+                        offset += header_size + size;
+                    }
+
+                    if (!frames.empty())
+                    {
+                        delivered = offset;
+                        co_return std::make_pair(frames.size(), error_code{});
+                    }
+
+                    if (auto [_, ec] = co_await Base::ReadSome(socket); ec)
+                    {
+                        co_return std::make_pair(std::size_t{ 0 }, ec);
+                    }
+                }
+            }
+
+            //! The base's completion token forms would skip the framing
+            template<class... Args>
+            void AsyncSend(Args&&...) = delete;
+
+            //! The base's completion token forms would skip the framing
+            template<class... Args>
+            void AsyncReadInto(Args&&...) = delete;
+
+            /**
+             * @brief Set the largest frame payload accepted on send and receive. The receive buffer
+             * grows to hold a whole frame if needed
+             *
+             * @param size The max payload size in bytes
+             */
+            void SetMaxFrameSize(std::size_t size)
+            {
+                if constexpr (Prefix == LengthPrefix::Fixed32)
+                {
+                    size = std::min<std::size_t>(size, UINT32_MAX);
+                }
+
+                max_frame_size = size;
+                if (this->read_buffer.Capacity() < size + max_header_size)
+                {
+                    this->read_buffer.Resize(size + max_header_size);
+                }
+            }
+
+            /**
+             * @brief Get the largest frame payload accepted on send and receive
+             *
+             * @return The max payload size in bytes
+             */
+            std::size_t GetMaxFrameSize() const
+            {
+                return max_frame_size;
+            }
+
+        private:
+            /**
+             * @brief Decode a frame header
+             *
+             * @param data The received bytes
+             * @param available The number of received bytes
+             * @param[out] size The payload size
+             * @param[out] header_size The header size, zero if the header is malformed
+             * @return False if more bytes are needed to decode the header
+             */
+            static bool DecodeHeader(const char* data, std::size_t available, std::size_t& size, std::size_t& header_size)
+            {
+                if constexpr (Prefix == LengthPrefix::Varint)
+                {
+                    size = 0;
+                    for (std::size_t i = 0; i < max_header_size; ++i)
+                    {
+                        if (i == available) { return false; }
+
+                        const auto byte = static_cast<std::uint8_t>(data[i]);
+                        size |= static_cast<std::size_t>(byte & 0x7f) << (7 * i);
+                        if (!(byte & 0x80))
+                        {
+                            header_size = i + 1;
+                            return true;
+                        }
+                    }
+
+                    //continuation bit set on every byte
+                    header_size = 0;
+                    return true;
+                }
+                else
+                {
+                    if (available < 4) { return false; }
+
+                    const auto* bytes = reinterpret_cast<const std::uint8_t*>(data);
+                    size = (std::size_t{ bytes[0] } << 24) | (std::size_t{ bytes[1] } << 16) | (std::size_t{ bytes[2] } << 8) | bytes[3];
+                    header_size = 4;
+                    return true;
+                }
+            }
+
+            //! The largest frame payload accepted, by default what fits in the receive buffer
+            std::size_t max_frame_size = RingBuffer::default_capacity - max_header_size;
+
+            //! Bytes of frames returned by the last read, consumed at the start of the next one
+            std::size_t delivered = 0;
+        };
+
+        //! Convenience alias for length prefixed frames over tcp
+        using FramedTcpProtocol = FramedProtocol<BasicProtocol<asio::ip::tcp>>;
+
+        //! Convenience alias for length prefixed frames over an ssl stream
+        using FramedSslProtocol = FramedProtocol<BasicProtocol<asio::ip::tcp, true>>;
+    }
+}
@@ -0,0 +1,135 @@
+/**
+ * @file HandshakePool.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the HandshakePool class, a fixed set of worker threads which run
+ * tls handshakes so their crypto does not stall the io threads
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "AsioIncludes.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @class HandshakePool
+         * @brief Runs tls handshakes on its own threads. The handshake's reads and writes still go through
+         * the socket, but the completion handlers, where openssl does the key exchange and certificate work,
+         * run on the pool. The awaiting coroutine resumes on its own executor afterwards. The socket must not
+         * be closed from another thread while its handshake runs, cancel the awaiting coroutine instead
+         */
+        class HandshakePool
+        {
+        public:
+            /**
+             * @brief Construct a new Handshake Pool object and start its threads
+             *
+             * @param threads The number of worker threads. Zero uses half the hardware concurrency
+             */
+            explicit HandshakePool(std::size_t threads = 0) :
+                workers(threads ? threads : std::max(1u, std::thread::hardware_concurrency() / 2))
+            {
+
+            }
+
+            HandshakePool(const HandshakePool&) = delete;
+            HandshakePool& operator=(const HandshakePool&) = delete;
+
+            /**
+             * @brief Destroy the Handshake Pool object, waits for handshakes in progress
+             *
+             */
+            ~HandshakePool()
+            {
+                workers.join();
+            }
+
+            /**
+             * @brief Do a tls handshake on the pool. Cancelling the awaiting coroutine, ie through a
+             * cancellation slot bound to its co_spawn, cancels the handshake on the pool
+             *
+             * @tparam Stream The ssl stream type
+             * @param stream The stream. Nothing else may use it until the handshake completes
+             * @param type Client or server
+             * @return The handshake error if there was one
+             */
+            template<class Stream>
+            asio::awaitable<error_code> Handshake(Stream& stream, asio::ssl::stream_base::handshake_type type)
+            {
+                //a strand of its own, so a cancellation is delivered in turn with the handshake's handlers
+                ++pending;
+                auto ec = co_await asio::co_spawn(asio::make_strand(workers.get_executor()), DoHandshake(stream, type), asio::use_awaitable);
+                --pending;
+                ++completed;
+                co_return ec;
+            }
+
+            /**
+             * @brief Get the number of handshakes queued or running on the pool
+             *
+             * @return The number of handshakes
+             */
+            std::size_t Pending() const
+            {
+                return pending.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Get the number of handshakes the pool has finished, successful or not
+             *
+             * @return The number of handshakes
+             */
+            std::size_t Completed() const
+            {
+                return completed.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Get the executor of the worker threads
+             *
+             * @return The executor
+             */
+            auto get_executor()
+            {
+                return workers.get_executor();
+            }
+
+        private:
+            /**
+             * @brief The handshake, spawned on the pool so its handlers run there
+             *
+             * @tparam Stream The ssl stream type
+             * @param stream The stream
+             * @param type Client or server
+             * @return The handshake error if there was one
+             */
+            template<class Stream>
+            static asio::awaitable<error_code> DoHandshake(Stream& stream, asio::ssl::stream_base::handshake_type type)
+            {
+                error_code ec{};
+                co_await stream.async_handshake(type, asio::redirect_error(asio::use_awaitable, ec));
+                co_return ec;
+            }
+
+            //! The worker threads
+            asio::thread_pool workers;
+
+            //! Handshakes queued or running
+            std::atomic<std::size_t> pending = 0;
+
+            //! Handshakes finished
+            std::atomic<std::size_t> completed = 0;
+        };
+    }
+}
@@ -0,0 +1,299 @@
+/**
+ * @file HappyEyeballs.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines ConnectEndpoints, which races connection attempts to resolved
+ * addresses as described by RFC 8305 (happy eyeballs)
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "AsioIncludes.h"
+#include "SocketOptions.h"
+#include "SocketTraits.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @brief Order endpoints so the address families alternate, starting with the family of the
+         * first endpoint. The order within each family is kept
+         *
+         * @tparam Protocol The asio internet protocol type
+         * @param results The resolved endpoints, in the order the resolver preferred them
+         * @return The reordered endpoints
+         */
+        template<class Protocol>
+        std::vector<typename Protocol::endpoint> InterleaveAddressFamilies(const asio::ip::basic_resolver_results<Protocol>& results)
+        {
+            std::vector<typename Protocol::endpoint> preferred;
+            std::vector<typename Protocol::endpoint> other;
+            for (const auto& entry : results)
+            {
+                const auto endpoint = entry.endpoint();
+                if (preferred.empty() || endpoint.protocol() == preferred.front().protocol())
+                {
+                    preferred.push_back(endpoint);
+                }
+                else
+                {
+                    other.push_back(endpoint);
+                }
+            }
+
+            std::vector<typename Protocol::endpoint> endpoints;
+            endpoints.reserve(preferred.size() + other.size());
+            for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); ++i)
+            {
+                if (i < preferred.size()) { endpoints.push_back(preferred[i]); }
+                if (i < other.size()) { endpoints.push_back(other[i]); }
+            }
+            return endpoints;
+        }
+
+        /**
+         * @class ConnectRace
+         * @brief Runs staggered connection attempts and keeps the first to succeed. Everything runs on one
+         * strand so attempts may finish on any thread of the executor. The caller's socket is never touched
+         * on the strand, the caller moves the winner into it once the race is over
+         * @tparam Protocol The asio internet protocol type
+         * @tparam Executor The executor type of the sockets
+         */
+        template<class Protocol, class Executor>
+        class ConnectRace : public std::enable_shared_from_this<ConnectRace<Protocol, Executor>>
+        {
+        public:
+            using endpoint_type = typename Protocol::endpoint;
+            using socket_type = asio::basic_stream_socket<Protocol, Executor>;
+
+            /**
+             * @brief Construct a new Connect Race object
+             *
+             * @param strand The strand the race runs on
+             * @param socket_executor The executor of the attempt sockets, so the winner can be moved into the caller's socket
+             */
+            ConnectRace(asio::strand<asio::any_io_executor> strand, Executor socket_executor) :
+                wake(strand),
+                socket_executor(socket_executor)
+            {
+
+            }
+
+            /**
+             * @brief Start attempts to each endpoint in turn until one connects or all have failed.
+             * The next attempt starts when the previous one fails or, when racing, after the attempt delay.
+             * Cancelling the coroutine, ie through a cancellation slot bound to its co_spawn, abandons the
+             * race and closes every attempt
+             *
+             * @param endpoints The endpoints, in the order to try them
+             * @param options If attempts are raced, the attempt delay and the options applied to each attempt socket
+             * @param[out] ec Set to the error of the last attempt to fail if none connected, or
+             * asio::error::operation_aborted if the race was cancelled
+             * @return The endpoint connected to. Its socket is left in Winner()
+             */
+            asio::awaitable<endpoint_type> Run(std::vector<endpoint_type> endpoints, ConnectOptions options, error_code& ec)
+            {
+                //a cancelled race still closes its attempts before returning
+                co_await asio::this_coro::throw_if_cancelled(false);
+                auto state = co_await asio::this_coro::cancellation_state;
+                const auto abandoned = [&state] { return state.cancelled() != asio::cancellation_type::none; };
+
+                ec = asio::error::not_found;
+                if (endpoints.empty()) { co_return endpoint_type{}; }
+
+                for (std::size_t i = 0; i < endpoints.size() && !winner && !abandoned(); ++i)
+                {
+                    auto& attempt = attempts.emplace_back(socket_executor);
+                    attempt.open(endpoints[i].protocol(), ec);
+                    if (ec)
+                    {
+                        //ie no ipv6 on this host, try the next address now
+                        last_error = ec;
+                        continue;
+                    }
+
+                    //best effort, the attempt still connects without them
+                    error_code option_ec{};
+                    ApplyConnectOptions(attempt, options, option_ec);
+
+                    ++pending;
+                    asio::co_spawn(wake.get_executor(), Attempt(this->shared_from_this(), i, endpoints[i]), asio::detached);
+
+                    if (i + 1 == endpoints.size()) { break; }
+
+                    //woken early if an attempt finishes, or by cancellation
+                    if (options.race)
+                    {
+                        co_await Sleep(options.attempt_delay);
+                        continue;
+                    }
+
+                    while (pending > 0 && !abandoned())
+                    {
+                        co_await Sleep(std::chrono::steady_clock::duration::max());
+                    }
+                }
+
+                while (!winner && pending > 0 && !abandoned())
+                {
+                    co_await Sleep(std::chrono::steady_clock::duration::max());
+                }
+
+                const bool aborted = abandoned();
+                for (std::size_t i = 0; i < attempts.size(); ++i)
+                {
+                    if (winner && *winner == i && !aborted) { continue; }
+
+                    //aborts attempts still in progress
+                    error_code close_ec{};
+                    attempts[i].close(close_ec);
+                }
+
+                if (aborted || !winner)
+                {
+                    ec = aborted ? error_code{ asio::error::operation_aborted } : last_error;
+                    co_return endpoint_type{};
+                }
+
+                ec = {};
+                co_return endpoints[*winner];
+            }
+
+            /**
+             * @brief Get the socket of the attempt which connected. Only use once Run has returned
+             * without error, from any thread
+             *
+             * @return The connected socket
+             */
+            socket_type& Winner()
+            {
+                return attempts[*winner];
+            }
+
+        private:
+            /**
+             * @brief Wait until an attempt finishes, the race is cancelled or the timeout passes. Returns
+             * at once if an attempt finished while Run was not waiting
+             *
+             * @param timeout The longest to wait
+             */
+            asio::awaitable<void> Sleep(std::chrono::steady_clock::duration timeout)
+            {
+                if (!woken)
+                {
+                    error_code ec{};
+                    if (timeout == std::chrono::steady_clock::duration::max())
+                    {
+                        wake.expires_at(asio::steady_timer::time_point::max());
+                    }
+                    else
+                    {
+                        wake.expires_after(timeout);
+                    }
+                    co_await wake.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                }
+                woken = false;
+            }
+
+            /**
+             * @brief Connect one attempt socket and wake the race when done
+             *
+             * @param self Keeps the race alive until the attempt finishes
+             * @param index The index of the attempt
+             * @param endpoint The endpoint to connect to
+             */
+            static asio::awaitable<void> Attempt(std::shared_ptr<ConnectRace> self, std::size_t index, endpoint_type endpoint)
+            {
+                error_code ec{};
+                co_await self->attempts[index].async_connect(endpoint, asio::redirect_error(asio::use_awaitable, ec));
+
+                --self->pending;
+                if (ec)
+                {
+                    self->last_error = ec;
+                }
+                else if (!self->winner)
+                {
+                    self->winner = index;
+                }
+
+                //Run may be between waits, the flag keeps the wake for its next one
+                self->woken = true;
+                self->wake.cancel();
+            }
+
+            //! Wakes Run when an attempt finishes or the attempt delay passes
+            asio::steady_timer wake;
+
+            //! Set when an attempt finishes, until Run has seen it
+            bool woken = false;
+
+            //! The executor of the attempt sockets
+            Executor socket_executor;
+
+            //! One socket per attempt started. A deque so references stay valid as attempts are added
+            std::deque<socket_type> attempts;
+
+            //! The number of attempts still connecting
+            std::size_t pending = 0;
+
+            //! The index of the first attempt to connect
+            std::optional<std::size_t> winner;
+
+            //! The error of the last attempt to fail
+            error_code last_error = asio::error::not_found;
+        };
+
+        /**
+         * @brief Connect a socket to one of the resolved endpoints. If racing, internet stream sockets race
+         * staggered attempts to the endpoints, alternating address families, and keep the first to
+         * connect. Other sockets, or a single endpoint, try the endpoints one after another. Tcp fast
+         * open is set on each attempt socket if requested. Cancelling the calling coroutine abandons a race
+         *
+         * @tparam Socket The socket type, ie asio::ip::tcp::socket or the lowest layer of an ssl stream
+         * @tparam Protocol The asio protocol type
+         * @param socket The socket to connect. Replaced by the winning attempt's socket when racing
+         * @param results The resolved endpoints
+         * @param options If and how to race
+         * @param[out] ec Set to the error of the last attempt to fail if none connected
+         * @return The endpoint connected to
+         */
+        template<class Socket, class Protocol>
+        asio::awaitable<typename Protocol::endpoint> ConnectEndpoints(Socket& socket, const asio::ip::basic_resolver_results<Protocol>& results, const ConnectOptions& options, error_code& ec)
+        {
+            if constexpr (!is_datagram_protocol_v<Protocol> && !is_local_protocol_v<Protocol>)
+            {
+                if ((options.race && results.size() > 1) || options.fast_open)
+                {
+                    using race_type = ConnectRace<Protocol, typename Socket::executor_type>;
+
+                    //the awaitable's cancellation slot reaches the race through co_spawn
+                    auto strand = asio::make_strand(asio::any_io_executor{ socket.get_executor() });
+                    auto race = std::make_shared<race_type>(strand, socket.get_executor());
+                    auto endpoint = co_await asio::co_spawn(strand, race->Run(InterleaveAddressFamilies(results), options, ec), asio::use_awaitable);
+
+                    //back on the caller's executor, the only place the caller's socket is used
+                    if (!ec)
+                    {
+                        socket = std::move(race->Winner());
+                    }
+                    co_return endpoint;
+                }
+            }
+
+            co_return co_await asio::async_connect(socket, results, asio::redirect_error(asio::use_awaitable, ec));
+        }
+    }
+}
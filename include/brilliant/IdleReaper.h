@@ -0,0 +1,486 @@
+/**
+ * @file IdleReaper.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the IdleReaper class template, a hierarchical timing wheel which
+ * disconnects connections that have been idle too long, and IdleTracking, the
+ * activity stamp it reads from each connection
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "AsioIncludes.h"
+#include "ConnectionPool.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @class IdleTracking
+         * @brief Held by each connection. Records the reaper tick of the connection's latest activity
+         * with a single relaxed store, the reaper compares it against its clock when the connection's
+         * entry comes due
+         */
+        class IdleTracking
+        {
+        public:
+            IdleTracking() = default;
+
+            /**
+             * @brief Construct a new Idle Tracking object from another. Only the last activity is kept,
+             * a moved connection is not tracked
+             *
+             * @param other The tracking to copy the last activity from
+             */
+            IdleTracking(IdleTracking&& other) noexcept :
+                last_tick(other.last_tick.load(std::memory_order_relaxed))
+            {
+
+            }
+
+            IdleTracking& operator=(IdleTracking&&) = delete;
+
+            /**
+             * @brief Record activity now. Does nothing unless a reaper tracks the connection
+             *
+             */
+            void Touch()
+            {
+                if (const auto* ticks = clock.load(std::memory_order_relaxed))
+                {
+                    last_tick.store(ticks->load(std::memory_order_relaxed), std::memory_order_relaxed);
+                }
+            }
+
+            /**
+             * @brief Get the reaper tick of the latest activity
+             *
+             * @return The tick
+             */
+            std::uint32_t LastTick() const
+            {
+                return last_tick.load(std::memory_order_relaxed);
+            }
+
+        private:
+            template<class Connection>
+            friend class IdleReaper;
+
+            //! The reaper tick of the latest activity
+            std::atomic<std::uint32_t> last_tick = 0;
+
+            //! The clock of the reaper tracking the connection, null if untracked. Cleared by the reaper while the connection may be in use
+            std::atomic<const std::atomic<std::uint32_t>*> clock = nullptr;
+
+            //! The reaper's entry for the connection
+            void* entry = nullptr;
+        };
+
+        /**
+         * @class IdleReaper
+         * @brief Disconnects connections with no activity for longer than the idle timeout. Connections sit
+         * in a four level hierarchical timing wheel of 64 slots per level, so tracking, untracking and each
+         * tick are O(1) amortized regardless of how many connections are tracked, and no timer is kept per
+         * connection. Activity does not touch the wheel: when an entry comes due its connection's last
+         * activity is checked, and it is rescheduled if the connection was active since. Safe to use from
+         * any thread, reaped connections are disconnected on their own executor
+         * @tparam Connection The connection type, ie AwaitableConnection. Needs GetIdleTracking(), a non blocking Close() and get_executor()
+         */
+        template<class Connection>
+        class IdleReaper : public std::enable_shared_from_this<IdleReaper<Connection>>
+        {
+        public:
+            using connection_type = Connection;
+
+            /**
+             * @brief Construct a new Idle Reaper object. Call Start to begin ticking
+             *
+             * @param exec The executor the wheel ticks on
+             * @param timeout How long a connection may be idle
+             * @param resolution The length of a tick. Connections are reaped up to a tick late
+             */
+            IdleReaper(asio::any_io_executor exec, std::chrono::steady_clock::duration timeout, std::chrono::steady_clock::duration resolution) :
+                timer(exec),
+                resolution(resolution.count() > 0 ? resolution : std::chrono::seconds(1)),
+                timeout_ticks(ToTicks(timeout))
+            {
+                for (auto& level : wheel)
+                {
+                    for (auto& slot : level)
+                    {
+                        slot.prev = slot.next = &slot;
+                    }
+                }
+            }
+
+            IdleReaper(const IdleReaper&) = delete;
+            IdleReaper& operator=(const IdleReaper&) = delete;
+
+            /**
+             * @brief Start ticking. The reaper must be owned by a shared_ptr
+             *
+             */
+            void Start()
+            {
+                std::lock_guard lock(mutex);
+                start = std::chrono::steady_clock::now();
+                timer.expires_at(start + resolution);
+                timer.async_wait([self = this->shared_from_this()](const error_code& ec) { self->OnTick(ec); });
+            }
+
+            /**
+             * @brief Stop ticking and forget every connection. Reaps already posted do nothing
+             *
+             */
+            void Stop()
+            {
+                std::lock_guard lock(mutex);
+                stopped = true;
+
+                //Stop may be called from any thread, the timer belongs to its executor
+                asio::post(timer.get_executor(), [self = this->shared_from_this()] {
+                    std::lock_guard lock(self->mutex);
+                    self->timer.cancel();
+                });
+
+                entries.ForEach([](Entry& entry) {
+                    entry.connection->GetIdleTracking().clock.store(nullptr, std::memory_order_relaxed);
+                    entry.connection->GetIdleTracking().entry = nullptr;
+                });
+                entries.Clear();
+            }
+
+            /**
+             * @brief Start tracking a connection, counting it active now
+             *
+             * @param connection The connection. Must be untracked before it is destroyed
+             */
+            void Track(connection_type* connection)
+            {
+                std::lock_guard lock(mutex);
+                if (stopped) { return; }
+
+                auto& tracking = connection->GetIdleTracking();
+                if (tracking.entry) { return; }
+
+                auto* entry = entries.Acquire();
+                entry->connection = connection;
+                entry->generation = ++generation;
+                tracking.entry = entry;
+                tracking.clock.store(&clock, std::memory_order_relaxed);
+                tracking.last_tick.store(Now(), std::memory_order_relaxed);
+                Place(entry, Now() + timeout_ticks);
+            }
+
+            /**
+             * @brief Stop tracking a connection
+             *
+             * @param connection The connection
+             */
+            void Untrack(connection_type* connection)
+            {
+                std::lock_guard lock(mutex);
+                auto& tracking = connection->GetIdleTracking();
+                auto* entry = static_cast<Entry*>(tracking.entry);
+                tracking.clock.store(nullptr, std::memory_order_relaxed);
+                tracking.entry = nullptr;
+                if (!entry) { return; }
+
+                Unlink(entry);
+                entries.Release(entry);
+            }
+
+            /**
+             * @brief Get the number of connections reaped
+             *
+             * @return The number of connections
+             */
+            std::size_t Reaped() const
+            {
+                return reaped.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Get the number of connections tracked
+             *
+             * @return The number of connections
+             */
+            std::size_t Tracked() const
+            {
+                std::lock_guard lock(mutex);
+                return entries.Size();
+            }
+
+        private:
+            //! Slots per wheel level, as a power of two
+            static constexpr std::uint32_t level_bits = 6;
+
+            //! Slots per wheel level
+            static constexpr std::uint32_t level_size = 1u << level_bits;
+
+            //! The number of wheel levels
+            static constexpr std::size_t levels = 4;
+
+            //! The furthest ahead an entry can be placed, later expiries are placed here and checked again
+            static constexpr std::uint32_t max_delay = (1u << (level_bits * levels)) - 1;
+
+            /**
+             * @struct Link
+             * @brief A node of the circular list of a wheel slot. Slots hold a link as their head
+             */
+            struct Link
+            {
+                Link* prev = nullptr;
+                Link* next = nullptr;
+            };
+
+            /**
+             * @struct Entry
+             * @brief A tracked connection's place in the wheel
+             */
+            struct Entry : Link
+            {
+                //! The connection
+                connection_type* connection = nullptr;
+
+                //! Tells a posted reap if the entry was untracked, and maybe reused, meanwhile
+                std::uint64_t generation = 0;
+
+                //! The tick the entry is due
+                std::uint32_t expiry = 0;
+            };
+
+            /**
+             * @brief Convert a duration to a whole number of ticks, rounding up
+             *
+             * @param duration The duration
+             * @return The number of ticks, at least one
+             */
+            std::uint32_t ToTicks(std::chrono::steady_clock::duration duration) const
+            {
+                if (duration.count() <= 0) { return 1; }
+
+                const auto ticks = (duration + resolution - std::chrono::steady_clock::duration{ 1 }) / resolution;
+                return static_cast<std::uint32_t>(std::clamp<decltype(ticks)>(ticks, 1, max_delay));
+            }
+
+            /**
+             * @brief Get the current tick
+             *
+             * @return The tick
+             */
+            std::uint32_t Now() const
+            {
+                return clock.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Put an entry in the slot for its expiry. The mutex must be held
+             *
+             * @param entry The entry, not in any slot
+             * @param expiry The tick the entry is due
+             */
+            void Place(Entry* entry, std::uint32_t expiry)
+            {
+                //the next tick to run is Now() + 1, due entries go there
+                const std::uint32_t next = Now() + 1;
+                const auto delay = static_cast<std::int32_t>(expiry - next);
+                if (delay < 0)
+                {
+                    expiry = next;
+                }
+                else if (static_cast<std::uint32_t>(delay) > max_delay)
+                {
+                    expiry = next + max_delay;
+                }
+                entry->expiry = expiry;
+
+                const std::uint32_t distance = expiry - next;
+                std::size_t level = 0;
+                while (level + 1 < levels && distance >= (1u << (level_bits * (level + 1))))
+                {
+                    ++level;
+                }
+
+                Link& head = wheel[level][(expiry >> (level_bits * level)) & (level_size - 1)];
+                entry->prev = head.prev;
+                entry->next = &head;
+                head.prev->next = entry;
+                head.prev = entry;
+            }
+
+            /**
+             * @brief Remove an entry from its slot if it is in one
+             *
+             * @param entry The entry
+             */
+            static void Unlink(Entry* entry)
+            {
+                if (!entry->next) { return; }
+
+                entry->prev->next = entry->next;
+                entry->next->prev = entry->prev;
+                entry->prev = entry->next = nullptr;
+            }
+
+            /**
+             * @brief Detach the entries of a slot
+             *
+             * @param head The slot
+             * @return The first entry, the entries are linked through next and end with null
+             */
+            static Entry* Take(Link& head)
+            {
+                if (head.next == &head) { return nullptr; }
+
+                head.prev->next = nullptr;
+                auto* first = static_cast<Entry*>(head.next);
+                head.prev = head.next = &head;
+                return first;
+            }
+
+            /**
+             * @brief Move the entries of a higher level slot down to the levels below as it comes in range
+             *
+             * @param level The level
+             * @param index The slot
+             * @return The slot, zero when the level above must cascade as well
+             */
+            std::uint32_t Cascade(std::size_t level, std::uint32_t index)
+            {
+                for (auto* entry = Take(wheel[level][index]); entry;)
+                {
+                    auto* following = static_cast<Entry*>(entry->next);
+                    entry->prev = entry->next = nullptr;
+                    Place(entry, entry->expiry);
+                    entry = following;
+                }
+                return index;
+            }
+
+            /**
+             * @brief Run one tick: cascade when the lowest level wraps, then check the entries due
+             *
+             */
+            void Advance()
+            {
+                const std::uint32_t next = Now() + 1;
+                const std::uint32_t index = next & (level_size - 1);
+                if (index == 0)
+                {
+                    for (std::size_t level = 1; level < levels; ++level)
+                    {
+                        if (Cascade(level, (next >> (level_bits * level)) & (level_size - 1)) != 0) { break; }
+                    }
+                }
+                clock.store(next, std::memory_order_relaxed);
+
+                for (auto* entry = Take(wheel[0][index]); entry;)
+                {
+                    auto* following = static_cast<Entry*>(entry->next);
+                    entry->prev = entry->next = nullptr;
+                    Check(entry);
+                    entry = following;
+                }
+            }
+
+            /**
+             * @brief Reschedule a due entry whose connection was active since it was placed, or reap it
+             *
+             * @param entry The due entry, not in any slot
+             */
+            void Check(Entry* entry)
+            {
+                const std::uint32_t last = entry->connection->GetIdleTracking().LastTick();
+                if (Now() - last < timeout_ticks)
+                {
+                    Place(entry, last + timeout_ticks);
+                    return;
+                }
+
+                //left out of the wheel until untracked, the connection's owner releases it once its operations fail
+                asio::post(entry->connection->get_executor(), [self = this->shared_from_this(), entry, generation = entry->generation] {
+                    connection_type* connection = nullptr;
+                    {
+                        std::lock_guard lock(self->mutex);
+                        if (self->stopped || entry->generation != generation || entry->connection->GetIdleTracking().entry != entry) { return; }
+                        connection = entry->connection;
+                    }
+
+                    //closed without a tls shutdown, which could block, and outside the lock so other ticks and
+                    //activity are not held up. The owner releases the connection on this executor too, so it is still alive
+                    connection->Close();
+                    self->reaped.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+
+            /**
+             * @brief Run the ticks which are due and wait for the next
+             *
+             * @param ec The wait error
+             */
+            void OnTick(const error_code& ec)
+            {
+                std::lock_guard lock(mutex);
+                if (ec || stopped) { return; }
+
+                //catch up if the executor was busy, rather than drifting
+                const auto now = std::chrono::steady_clock::now();
+                const auto target = static_cast<std::uint32_t>((now - start) / resolution);
+                while (static_cast<std::int32_t>(target - Now()) > 0)
+                {
+                    Advance();
+                }
+
+                timer.expires_at(start + resolution * (static_cast<std::int64_t>(target) + 1));
+                timer.async_wait([self = this->shared_from_this()](const error_code& ec) { self->OnTick(ec); });
+            }
+
+            //! Fires once per tick
+            asio::steady_timer timer;
+
+            //! The length of a tick
+            std::chrono::steady_clock::duration resolution;
+
+            //! How many ticks a connection may be idle
+            std::uint32_t timeout_ticks;
+
+            //! When ticking started, ticks are counted from here
+            std::chrono::steady_clock::time_point start;
+
+            //! The current tick, read by connections when they record activity
+            std::atomic<std::uint32_t> clock = 0;
+
+            //! The wheel, each slot is the head of a circular list of entries
+            std::array<std::array<Link, level_size>, levels> wheel;
+
+            //! Storage for entries, reused as connections come and go
+            ConnectionPool<Entry, 256> entries;
+
+            //! Counts entries so a posted reap can tell its entry was reused
+            std::uint64_t generation = 0;
+
+            //! The number of connections reaped
+            std::atomic<std::size_t> reaped = 0;
+
+            //! Set by Stop
+            bool stopped = false;
+
+            //! Guards everything above except the atomics
+            mutable std::mutex mutex;
+        };
+    }
+}
@@ -0,0 +1,381 @@
+/**
+ * @file IoContextPool.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the IoContextPool class, which runs one io_context per thread,
+ * and placement policies which choose the io_context an accepted connection runs on
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif //__linux__
+
+#include "AsioIncludes.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @brief Get the cpus belonging to a NUMA node
+         *
+         * @param node The NUMA node index
+         * @return The cpu indices of the node. Empty if the node does not exist or the platform
+         * does not expose NUMA topology
+         */
+        inline std::vector<int> CpusOfNumaNode(int node)
+        {
+            std::vector<int> cpus;
+#ifdef __linux__
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            if (!std::getline(file, list))
+            {
+                return cpus;
+            }
+
+            //cpulist is a comma separated list of cpus and inclusive ranges, ie "0-3,8-11"
+            std::string_view rest{ list };
+            while (!rest.empty())
+            {
+                auto comma = rest.find(',');
+                auto item = rest.substr(0, comma);
+                rest = comma == std::string_view::npos ? std::string_view{} : rest.substr(comma + 1);
+
+                int first{}, last{};
+                auto [ptr, err] = std::from_chars(item.data(), item.data() + item.size(), first);
+                if (err != std::errc{}) { continue; }
+
+                last = first;
+                if (ptr != item.data() + item.size() && *ptr == '-')
+                {
+                    std::from_chars(ptr + 1, item.data() + item.size(), last);
+                }
+
+                for (int cpu = first; cpu <= last; ++cpu)
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+#else
+            (void)node;
+#endif //__linux__
+            return cpus;
+        }
+
+        /**
+         * @struct IoContextPoolOptions
+         * @brief Options for creating an IoContextPool
+         */
+        struct IoContextPoolOptions
+        {
+            //! The number of threads, each running its own io_context. Zero uses the hardware concurrency
+            std::size_t threads = 0;
+
+            //! Pin each thread to a single cpu. Only supported on linux
+            bool pin_threads = false;
+
+            //! The cpus threads are pinned to, thread i uses cpus[i % cpus.size()]. If empty the cpus of
+            //! numa_node are used, or cpus 0..threads-1 if numa_node is negative
+            std::vector<int> cpus;
+
+            //! The NUMA node to take cpus from when cpus is empty. Negative for no preference
+            int numa_node = -1;
+        };
+
+        /**
+         * @class IoContextPool
+         * @brief Runs one io_context on each of a fixed number of threads, so work placed
+         * on a context always runs on the same thread. Optionally pins the threads to cpus
+         */
+        class IoContextPool
+        {
+        public:
+            /**
+             * @brief Construct a new Io Context Pool object and start its threads
+             *
+             * @param options The pool options
+             */
+            explicit IoContextPool(IoContextPoolOptions options = {})
+            {
+                std::size_t count = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+                if (options.cpus.empty() && options.numa_node >= 0)
+                {
+                    options.cpus = CpusOfNumaNode(options.numa_node);
+                }
+
+                loads = std::make_unique<std::atomic<std::size_t>[]>(count);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    //one thread runs each context. Hint 1 tells asio so, which lets it queue handlers posted from that
+                    //thread without waking other threads. Its locks stay on, other threads still post to the context
+                    auto& context = contexts.emplace_back(std::make_unique<asio::io_context>(1));
+                    guards.emplace_back(asio::make_work_guard(*context));
+                }
+
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    int cpu = -1;
+                    if (options.pin_threads)
+                    {
+                        cpu = options.cpus.empty() ? static_cast<int>(i) : options.cpus[i % options.cpus.size()];
+                    }
+
+                    threads.emplace_back([context = contexts[i].get(), cpu]() {
+                        PinCurrentThread(cpu);
+                        context->run();
+                    });
+                }
+            }
+
+            IoContextPool(const IoContextPool&) = delete;
+            IoContextPool& operator=(const IoContextPool&) = delete;
+
+            /**
+             * @brief Destroy the Io Context Pool object. Stops all contexts and joins the threads
+             *
+             */
+            ~IoContextPool()
+            {
+                Stop();
+                Join();
+            }
+
+            /**
+             * @brief Allow the contexts to finish once they run out of work
+             *
+             */
+            void Finish()
+            {
+                guards.clear();
+            }
+
+            /**
+             * @brief Stop all contexts as soon as possible
+             *
+             */
+            void Stop()
+            {
+                for (auto& context : contexts)
+                {
+                    context->stop();
+                }
+            }
+
+            /**
+             * @brief Wait for all threads to exit
+             *
+             */
+            void Join()
+            {
+                for (auto& thread : threads)
+                {
+                    if (thread.joinable())
+                    {
+                        thread.join();
+                    }
+                }
+            }
+
+            /**
+             * @brief Get the number of contexts in the pool
+             *
+             * @return The number of contexts
+             */
+            std::size_t Size() const
+            {
+                return contexts.size();
+            }
+
+            /**
+             * @brief Get a context
+             *
+             * @param index The context index
+             * @return The context
+             */
+            asio::io_context& GetContext(std::size_t index)
+            {
+                return *contexts[index];
+            }
+
+            /**
+             * @brief Get the executor of a context
+             *
+             * @param index The context index
+             * @return The executor
+             */
+            asio::any_io_executor GetExecutor(std::size_t index) const
+            {
+                return contexts[index]->get_executor();
+            }
+
+            /**
+             * @brief Find the context an executor belongs to
+             *
+             * @param exec The executor
+             * @return The context index, or Size() if the executor does not belong to the pool
+             */
+            std::size_t IndexOf(const asio::any_io_executor& exec) const
+            {
+                for (std::size_t i = 0; i < contexts.size(); ++i)
+                {
+                    if (exec == asio::any_io_executor{ contexts[i]->get_executor() })
+                    {
+                        return i;
+                    }
+                }
+                return contexts.size();
+            }
+
+            /**
+             * @brief Get the number of connections placed on a context
+             *
+             * @param index The context index
+             * @return The number of connections
+             */
+            std::size_t Load(std::size_t index) const
+            {
+                return loads[index].load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Record a connection being placed on a context
+             *
+             * @param index The context index
+             */
+            void AddLoad(std::size_t index)
+            {
+                loads[index].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief Record a connection leaving a context
+             *
+             * @param index The context index
+             */
+            void RemoveLoad(std::size_t index)
+            {
+                loads[index].fetch_sub(1, std::memory_order_relaxed);
+            }
+
+        private:
+            /**
+             * @brief Pin the calling thread to a cpu
+             *
+             * @param cpu The cpu index. Negative values leave the thread unpinned
+             */
+            static void PinCurrentThread([[maybe_unused]] int cpu)
+            {
+#ifdef __linux__
+                if (cpu < 0 || cpu >= CPU_SETSIZE) { return; }
+
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif //__linux__
+            }
+
+            //! The contexts, one per thread
+            std::vector<std::unique_ptr<asio::io_context>> contexts;
+
+            //! Keep the contexts running while they have no work
+            std::vector<asio::executor_work_guard<asio::io_context::executor_type>> guards;
+
+            //! The threads running the contexts
+            std::vector<std::thread> threads;
+
+            //! The number of connections placed on each context
+            std::unique_ptr<std::atomic<std::size_t>[]> loads;
+        };
+
+        /**
+         * @struct RoundRobinPlacement
+         * @brief Places connections on each context in turn
+         */
+        struct RoundRobinPlacement
+        {
+            template<class Endpoint>
+            std::size_t operator()(const IoContextPool& pool, const Endpoint&)
+            {
+                return next++ % pool.Size();
+            }
+
+            //! The next context to place on
+            std::size_t next = 0;
+        };
+
+        /**
+         * @struct LeastConnectionsPlacement
+         * @brief Places connections on the context with the fewest connections
+         */
+        struct LeastConnectionsPlacement
+        {
+            template<class Endpoint>
+            std::size_t operator()(const IoContextPool& pool, const Endpoint&) const
+            {
+                std::size_t best = 0;
+                std::size_t best_load = std::numeric_limits<std::size_t>::max();
+                for (std::size_t i = 0; i < pool.Size(); ++i)
+                {
+                    if (auto load = pool.Load(i); load < best_load)
+                    {
+                        best = i;
+                        best_load = load;
+                    }
+                }
+                return best;
+            }
+        };
+
+        /**
+         * @struct PeerHashPlacement
+         * @brief Places connections by a hash of the peer address so a peer always lands on the same context
+         */
+        struct PeerHashPlacement
+        {
+            template<class Endpoint>
+            std::size_t operator()(const IoContextPool& pool, const Endpoint& peer) const
+            {
+                std::size_t hash{};
+                if constexpr (requires { peer.address(); })
+                {
+                    auto address = peer.address();
+                    if (address.is_v4())
+                    {
+                        hash = std::hash<std::uint32_t>{}(address.to_v4().to_uint());
+                    }
+                    else
+                    {
+                        auto bytes = address.to_v6().to_bytes();
+                        hash = std::hash<std::string_view>{}(std::string_view{ reinterpret_cast<const char*>(bytes.data()), bytes.size() });
+                    }
+                }
+                else
+                {
+                    hash = std::hash<std::string_view>{}(std::string_view{ reinterpret_cast<const char*>(peer.data()), peer.size() });
+                }
+                return hash % pool.Size();
+            }
+        };
+    }
+}
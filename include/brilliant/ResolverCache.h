@@ -0,0 +1,506 @@
+/**
+ * @file ResolverCache.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the ResolverCache class template, a shared cache of name
+ * resolution results with expiry, negative caching and joining of concurrent lookups
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "AsioIncludes.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @struct ResolverCacheOptions
+         * @brief Expiry and size limits for a ResolverCache
+         */
+        struct ResolverCacheOptions
+        {
+            //! How long successful results are kept. Zero keeps nothing, concurrent lookups are still joined
+            std::chrono::steady_clock::duration ttl = std::chrono::seconds(30);
+
+            //! How long failed lookups are kept, so a bad name is not looked up again on every connect
+            std::chrono::steady_clock::duration negative_ttl = std::chrono::seconds(5);
+
+            //! The most entries kept. Expired entries are dropped first when the cache is full
+            std::size_t max_entries = 1024;
+        };
+
+        /**
+         * @class ResolverCache
+         * @brief Caches resolver results by host and service for one internet protocol. Safe to share
+         * between threads. A lookup for a name already being looked up waits for that lookup instead of
+         * starting another
+         * @tparam InternetProtocol The asio protocol type, ie asio::ip::tcp
+         */
+        template<class InternetProtocol>
+        class ResolverCache
+        {
+        public:
+            using protocol_type = InternetProtocol;
+            using resolver_type = asio::ip::basic_resolver<protocol_type>;
+            using results_type = typename resolver_type::results_type;
+
+            /**
+             * @brief Construct a new Resolver Cache object
+             *
+             * @param options Expiry and size limits
+             */
+            explicit ResolverCache(ResolverCacheOptions options = {}) :
+                options(options)
+            {
+
+            }
+
+            ResolverCache(const ResolverCache&) = delete;
+            ResolverCache& operator=(const ResolverCache&) = delete;
+
+            /**
+             * @brief Get the cache shared by the whole process, used by ResolveEndpoints
+             *
+             * @return The shared cache
+             */
+            static ResolverCache& Default()
+            {
+                static ResolverCache cache;
+                return cache;
+            }
+
+            /**
+             * @brief Resolve a host and service with the system resolver, from the cache if possible
+             *
+             * @param exec The executor for the resolver if a lookup is needed
+             * @param host The host
+             * @param service The service
+             * @param[out] ec Set to the error of the lookup if it failed
+             * @return The resolved endpoints
+             */
+            asio::awaitable<results_type> Resolve(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec)
+            {
+                return Resolve(exec, host, service, ec, &ResolverCache::SystemLookup);
+            }
+
+            /**
+             * @brief Resolve a host and service with the given lookup, from the cache if possible
+             *
+             * @tparam Lookup Callable as lookup(exec, host, service, ec, ttl) returning an awaitable of
+             * results_type. ttl starts at the cache ttl and may be lowered, ie to the ttl of the records found
+             * @param exec The executor for the lookup if one is needed
+             * @param host The host
+             * @param service The service
+             * @param[out] ec Set to the error of the lookup if it failed
+             * @param lookup Does the lookup on a miss
+             * @return The resolved endpoints
+             */
+            template<class Lookup>
+            asio::awaitable<results_type> Resolve(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec, Lookup lookup)
+            {
+                auto key = MakeKey(host, service);
+                while (true)
+                {
+                    std::shared_ptr<Flight> flight;
+                    bool leader = false;
+                    std::chrono::steady_clock::duration lookup_ttl{};
+                    {
+                        std::lock_guard lock(mutex);
+                        auto it = entries.find(key);
+                        if (it != entries.end() && !it->second.flight && std::chrono::steady_clock::now() < it->second.expires)
+                        {
+                            ++hits;
+                            ec = it->second.error;
+                            co_return it->second.results;
+                        }
+
+                        if (it != entries.end() && it->second.flight)
+                        {
+                            ++hits;
+                            flight = it->second.flight;
+                        }
+                        else
+                        {
+                            ++misses;
+                            MakeRoom();
+                            flight = std::make_shared<Flight>();
+                            entries[key] = Entry{ {}, {}, {}, flight };
+                            leader = true;
+                            lookup_ttl = options.ttl;
+                        }
+                    }
+
+                    if (!leader)
+                    {
+                        auto results = co_await Join(flight, ec);
+
+                        //the leader gave up, one of the waiters looks the name up again
+                        if (flight->abandoned)
+                        {
+                            ec = {};
+                            continue;
+                        }
+                        co_return results;
+                    }
+
+                    //abandons the flight if the lookup throws, is cancelled or its frame is destroyed
+                    FlightGuard guard{ this, &key, flight };
+                    auto results = co_await lookup(exec, host, service, ec, lookup_ttl);
+                    if (ec != asio::error::operation_aborted)
+                    {
+                        Finish(key, std::exchange(guard.flight, nullptr), ec, results, lookup_ttl);
+                    }
+                    co_return results;
+                }
+            }
+
+            /**
+             * @brief Drop an entry, ie after connecting to every endpoint it held failed
+             *
+             * @param host The host
+             * @param service The service
+             */
+            void Invalidate(std::string_view host, std::string_view service)
+            {
+                std::lock_guard lock(mutex);
+                auto it = entries.find(MakeKey(host, service));
+                if (it != entries.end() && !it->second.flight)
+                {
+                    entries.erase(it);
+                }
+            }
+
+            /**
+             * @brief Drop every entry not being looked up
+             *
+             */
+            void Clear()
+            {
+                std::lock_guard lock(mutex);
+                std::erase_if(entries, [](const auto& item) { return !item.second.flight; });
+            }
+
+            /**
+             * @brief Set the expiry and size limits. Applies to entries stored from now on
+             *
+             * @param opts The options
+             */
+            void SetOptions(const ResolverCacheOptions& opts)
+            {
+                std::lock_guard lock(mutex);
+                options = opts;
+            }
+
+            /**
+             * @brief Get the number of lookups answered from the cache or by joining a lookup in progress
+             *
+             * @return The number of hits
+             */
+            std::size_t Hits() const
+            {
+                std::lock_guard lock(mutex);
+                return hits;
+            }
+
+            /**
+             * @brief Get the number of lookups which went to the resolver
+             *
+             * @return The number of misses
+             */
+            std::size_t Misses() const
+            {
+                std::lock_guard lock(mutex);
+                return misses;
+            }
+
+        private:
+            /**
+             * @brief Look up a host and service with the system resolver
+             *
+             * @param exec The executor for the resolver
+             * @param host The host
+             * @param service The service
+             * @param[out] ec Set if the lookup failed
+             * @param ttl Unchanged, the system resolver does not report record ttls
+             * @return The resolved endpoints
+             */
+            static asio::awaitable<results_type> SystemLookup(asio::any_io_executor exec, std::string_view host, std::string_view service, error_code& ec, [[maybe_unused]] std::chrono::steady_clock::duration& ttl)
+            {
+                resolver_type resolver(exec);
+                co_return co_await resolver.async_resolve(host, service, asio::redirect_error(asio::use_awaitable, ec));
+            }
+
+            /**
+             * @struct WaiterBase
+             * @brief A type erased completion handler of a lookup waiting on another
+             */
+            struct WaiterBase
+            {
+                virtual ~WaiterBase() = default;
+                virtual void Complete(error_code ec, results_type results) = 0;
+            };
+
+            /**
+             * @struct Waiter
+             * @brief Holds a completion handler and runs it on the handler's executor. Keeps work outstanding
+             * on that executor for the whole wait, so a context with nothing else to do does not return from
+             * run() and strand the waiting frame while the lookup runs elsewhere
+             * @tparam Handler The completion handler type
+             */
+            template<class Handler>
+            struct Waiter : WaiterBase
+            {
+                explicit Waiter(Handler&& h) :
+                    handler(std::move(h)),
+                    work(asio::prefer(asio::get_associated_executor(handler), asio::execution::outstanding_work.tracked))
+                {
+
+                }
+
+                void Complete(error_code ec, results_type results) override
+                {
+                    asio::post(work, [handler = std::move(handler), ec, results = std::move(results)]() mutable {
+                        std::move(handler)(ec, std::move(results));
+                    });
+                }
+
+                Handler handler;
+
+                //! The handler's executor, tracking work until the waiter is destroyed
+                std::decay_t<decltype(asio::prefer(asio::get_associated_executor(std::declval<Handler&>()), asio::execution::outstanding_work.tracked))> work;
+            };
+
+            /**
+             * @struct Flight
+             * @brief A lookup in progress and the lookups waiting on it
+             */
+            struct Flight
+            {
+                //! Lookups waiting for the result
+                std::vector<std::unique_ptr<WaiterBase>> waiters;
+
+                //! Set once the result is ready
+                bool done = false;
+
+                //! Set if the lookup ended without a result, waiters then look the name up again
+                bool abandoned = false;
+
+                //! The result, once done
+                results_type results;
+
+                //! The error, once done
+                error_code error;
+            };
+
+            /**
+             * @struct Entry
+             * @brief A cached result, or a lookup in progress
+             */
+            struct Entry
+            {
+                //! The resolved endpoints
+                results_type results;
+
+                //! The lookup error, set for negative entries
+                error_code error;
+
+                //! When the entry expires
+                std::chrono::steady_clock::time_point expires;
+
+                //! The lookup in progress, if any
+                std::shared_ptr<Flight> flight;
+            };
+
+            /**
+             * @struct FlightGuard
+             * @brief Abandons a lookup in progress unless it was finished, so its entry and waiters are not left behind
+             */
+            struct FlightGuard
+            {
+                ~FlightGuard()
+                {
+                    if (flight)
+                    {
+                        cache->Abandon(*key, flight);
+                    }
+                }
+
+                //! The cache
+                ResolverCache* cache;
+
+                //! The key of the entry
+                const std::string* key;
+
+                //! The lookup, reset once finished
+                std::shared_ptr<Flight> flight;
+            };
+
+            /**
+             * @brief Store the result of a lookup and complete the lookups waiting on it
+             *
+             * @param key The key of the entry
+             * @param flight The lookup
+             * @param ec The error of the lookup
+             * @param results The resolved endpoints
+             * @param lookup_ttl The ttl reported by the lookup
+             */
+            void Finish(const std::string& key, std::shared_ptr<Flight> flight, error_code ec, const results_type& results, std::chrono::steady_clock::duration lookup_ttl)
+            {
+                std::vector<std::unique_ptr<WaiterBase>> waiters;
+                {
+                    std::lock_guard lock(mutex);
+                    flight->done = true;
+                    flight->results = results;
+                    flight->error = ec;
+                    waiters = std::move(flight->waiters);
+
+                    const auto ttl = ec ? options.negative_ttl : std::min(lookup_ttl, options.ttl);
+                    if (ttl.count() <= 0)
+                    {
+                        EraseFlight(key, flight);
+                    }
+                    else
+                    {
+                        entries[key] = Entry{ results, ec, std::chrono::steady_clock::now() + ttl, nullptr };
+                    }
+                }
+
+                for (auto& waiter : waiters)
+                {
+                    waiter->Complete(ec, results);
+                }
+            }
+
+            /**
+             * @brief Drop a lookup which ended without a result and wake the lookups waiting on it so they retry
+             *
+             * @param key The key of the entry
+             * @param flight The lookup
+             */
+            void Abandon(const std::string& key, const std::shared_ptr<Flight>& flight)
+            {
+                std::vector<std::unique_ptr<WaiterBase>> waiters;
+                {
+                    std::lock_guard lock(mutex);
+                    flight->done = true;
+                    flight->abandoned = true;
+                    flight->error = asio::error::operation_aborted;
+                    waiters = std::move(flight->waiters);
+                    EraseFlight(key, flight);
+                }
+
+                for (auto& waiter : waiters)
+                {
+                    waiter->Complete(asio::error::operation_aborted, {});
+                }
+            }
+
+            /**
+             * @brief Erase the entry of a lookup, unless it already holds something else
+             *
+             * @param key The key of the entry
+             * @param flight The lookup
+             */
+            void EraseFlight(const std::string& key, const std::shared_ptr<Flight>& flight)
+            {
+                auto it = entries.find(key);
+                if (it != entries.end() && it->second.flight == flight)
+                {
+                    entries.erase(it);
+                }
+            }
+
+            /**
+             * @brief Wait for a lookup in progress to finish
+             *
+             * @param flight The lookup
+             * @param[out] ec Set to the error of the lookup if it failed
+             * @return The resolved endpoints
+             */
+            asio::awaitable<results_type> Join(std::shared_ptr<Flight> flight, error_code& ec)
+            {
+                error_code join_ec{};
+                auto token = asio::redirect_error(asio::use_awaitable, join_ec);
+                auto results = co_await asio::async_initiate<decltype(token), void(error_code, results_type)>(
+                    [this, flight = flight.get()](auto handler) {
+                        std::lock_guard lock(mutex);
+                        auto waiter = std::make_unique<Waiter<decltype(handler)>>(std::move(handler));
+                        if (flight->done)
+                        {
+                            //finished between the lookup and here
+                            waiter->Complete(flight->error, flight->results);
+                            return;
+                        }
+                        flight->waiters.push_back(std::move(waiter));
+                    },
+                    token);
+                ec = join_ec;
+                co_return results;
+            }
+
+            /**
+             * @brief Make room for an entry if the cache is full. Drops expired entries, then any entry
+             * not being looked up
+             *
+             */
+            void MakeRoom()
+            {
+                if (entries.size() < options.max_entries) { return; }
+
+                const auto now = std::chrono::steady_clock::now();
+                std::erase_if(entries, [now](const auto& item) { return !item.second.flight && item.second.expires <= now; });
+                for (auto it = entries.begin(); it != entries.end() && entries.size() >= options.max_entries;)
+                {
+                    it = it->second.flight ? std::next(it) : entries.erase(it);
+                }
+            }
+
+            /**
+             * @brief Make the key of a host and service
+             *
+             * @param host The host
+             * @param service The service
+             * @return The key
+             */
+            static std::string MakeKey(std::string_view host, std::string_view service)
+            {
+                std::string key;
+                key.reserve(host.size() + service.size() + 1);
+                key.append(host).push_back('\0');
+                key.append(service);
+                return key;
+            }
+
+            //! Expiry and size limits
+            ResolverCacheOptions options;
+
+            //! Entries by host and service
+            std::unordered_map<std::string, Entry> entries;
+
+            //! The number of lookups answered without the resolver
+            std::size_t hits = 0;
+
+            //! The number of lookups which went to the resolver
+            std::size_t misses = 0;
+
+            //! Guards everything above
+            mutable std::mutex mutex;
+        };
+    }
+}
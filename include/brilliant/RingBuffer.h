@@ -0,0 +1,232 @@
+/**
+ * @file RingBuffer.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the RingBuffer class, a fixed capacity circular byte buffer
+ * used for streaming reads
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+#include "AsioIncludes.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @class RingBuffer
+         * @brief A fixed capacity circular byte buffer. Readable and writable regions are exposed
+         * as sequences of up to two buffers so a single scattered read can fill all free space
+         */
+        class RingBuffer
+        {
+        public:
+            using const_buffers_type = std::array<asio::const_buffer, 2>;
+            using mutable_buffers_type = std::array<asio::mutable_buffer, 2>;
+
+            //! The capacity used when none is given
+            static constexpr std::size_t default_capacity = 64 * 1024;
+
+            /**
+             * @brief Construct a new Ring Buffer object. Storage is allocated on first use
+             *
+             * @param capacity The capacity in bytes
+             */
+            explicit RingBuffer(std::size_t capacity = default_capacity) :
+                capacity(capacity)
+            {
+
+            }
+
+            /**
+             * @brief Change the capacity. Buffered bytes are kept if they fit
+             *
+             * @param new_capacity The capacity in bytes
+             * @return True if the capacity was changed, false if more bytes than new_capacity are buffered
+             */
+            bool Resize(std::size_t new_capacity)
+            {
+                if (new_capacity < size) { return false; }
+
+                if (storage)
+                {
+                    auto resized = std::make_unique<char[]>(new_capacity);
+                    CopyOut(resized.get(), size);
+                    storage = std::move(resized);
+                    head = 0;
+                }
+                capacity = new_capacity;
+                return true;
+            }
+
+            /**
+             * @brief Get the readable bytes
+             *
+             * @return Up to two buffers holding the readable bytes in order
+             */
+            const_buffers_type Data() const
+            {
+                const std::size_t first = std::min(size, capacity - head);
+                return { asio::const_buffer{ storage.get() + head, first }, asio::const_buffer{ storage.get(), size - first } };
+            }
+
+            /**
+             * @brief Get the free space
+             *
+             * @return Up to two buffers covering all free space in order
+             */
+            mutable_buffers_type Prepare()
+            {
+                if (capacity == 0) { return {}; }
+
+                Allocate();
+                const std::size_t tail = (head + size) % capacity;
+                const std::size_t free = capacity - size;
+                const std::size_t first = std::min(free, capacity - tail);
+                return { asio::mutable_buffer{ storage.get() + tail, first }, asio::mutable_buffer{ storage.get(), free - first } };
+            }
+
+            /**
+             * @brief Make bytes written to the free space readable
+             *
+             * @param n The number of bytes written
+             */
+            void Commit(std::size_t n)
+            {
+                size += std::min(n, capacity - size);
+            }
+
+            /**
+             * @brief Discard readable bytes from the front of the buffer
+             *
+             * @param n The number of bytes to discard
+             */
+            void Consume(std::size_t n)
+            {
+                n = std::min(n, size);
+                size -= n;
+                head = size == 0 ? 0 : (head + n) % capacity;
+            }
+
+            /**
+             * @brief Rotate the storage in place so all readable bytes are contiguous
+             *
+             * @return A single buffer holding the readable bytes
+             */
+            asio::const_buffer Linearize()
+            {
+                if (head + size > capacity)
+                {
+                    std::rotate(storage.get(), storage.get() + head, storage.get() + capacity);
+                    head = 0;
+                }
+                return asio::const_buffer{ storage.get() + head, size };
+            }
+
+            /**
+             * @brief Copy readable bytes out and consume them
+             *
+             * @param dest The buffer to copy into
+             * @return The number of bytes copied
+             */
+            std::size_t Read(const asio::mutable_buffer& dest)
+            {
+                const std::size_t n = std::min(dest.size(), size);
+                CopyOut(static_cast<char*>(dest.data()), n);
+                Consume(n);
+                return n;
+            }
+
+            /**
+             * @brief Discard all readable bytes
+             *
+             */
+            void Clear()
+            {
+                head = 0;
+                size = 0;
+            }
+
+            /**
+             * @brief Get the number of readable bytes
+             *
+             * @return The number of readable bytes
+             */
+            std::size_t Size() const
+            {
+                return size;
+            }
+
+            /**
+             * @brief Get the capacity
+             *
+             * @return The capacity in bytes
+             */
+            std::size_t Capacity() const
+            {
+                return capacity;
+            }
+
+            /**
+             * @brief Tells if there is no free space
+             *
+             * @return True if the buffer is full
+             */
+            bool Full() const
+            {
+                return size == capacity;
+            }
+
+        private:
+            /**
+             * @brief Allocate the storage if it has not been yet
+             *
+             */
+            void Allocate()
+            {
+                if (!storage)
+                {
+                    storage = std::make_unique<char[]>(capacity);
+                }
+            }
+
+            /**
+             * @brief Copy readable bytes, in order, without consuming them
+             *
+             * @param dest The destination
+             * @param n The number of bytes to copy, at most Size()
+             */
+            void CopyOut(char* dest, std::size_t n) const
+            {
+                if (n == 0) { return; }
+
+                const std::size_t first = std::min(n, capacity - head);
+                std::memcpy(dest, storage.get() + head, first);
+                std::memcpy(dest + first, storage.get(), n - first);
+            }
+
+            //! The storage, allocated on first use
+            std::unique_ptr<char[]> storage;
+
+            //! The capacity of the storage
+            std::size_t capacity;
+
+            //! The offset of the first readable byte
+            std::size_t head = 0;
+
+            //! The number of readable bytes
+            std::size_t size = 0;
+        };
+    }
+}
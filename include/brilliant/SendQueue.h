@@ -0,0 +1,546 @@
+/**
+ * @file SendQueue.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the SendQueue class, which serializes sends on a stream and
+ * coalesces sends issued while a write is in flight into a single gathered write
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "AsioIncludes.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @struct SendQueueOptions
+         * @brief Limits and timing for a SendQueue
+         */
+        struct SendQueueOptions
+        {
+            //! The most bytes gathered into one write. A single larger send is still written whole
+            std::size_t max_bytes = 64 * 1024;
+
+            //! The most buffers gathered into one write
+            std::size_t max_buffers = 64;
+
+            //! If non zero, the first send on an idle stream waits this long for more sends to join the
+            //! write. The wait ends early once max_bytes or max_buffers are queued
+            std::chrono::microseconds cork{ 0 };
+        };
+
+        /**
+         * @brief Satisfied by protocols which put a header in front of each message, ie FramedProtocol.
+         * The queue writes each message's header and payload with the base protocol
+         */
+        template<class Protocol>
+        concept framing_protocol = requires (const Protocol& protocol, std::size_t size, char* out) {
+            typename Protocol::base_type;
+            { Protocol::EncodeHeader(size, out) } -> std::convertible_to<std::size_t>;
+            { protocol.GetMaxFrameSize() } -> std::convertible_to<std::size_t>;
+        };
+
+        /**
+         * @class SendQueue
+         * @brief Outbound queue for a stream connection. The first send on an idle stream starts a write
+         * loop which keeps writing until the queue is empty. Sends made while a write is in flight are
+         * queued and go out together in the next gathered write. Each sender returns as soon as the write
+         * covering its own data has finished. All sends on a queue must run on the same executor, or strand
+         */
+        class SendQueue
+        {
+        public:
+            SendQueue() = default;
+
+            SendQueue(const SendQueue&) = delete;
+
+            SendQueue& operator=(const SendQueue&) = delete;
+
+            /**
+             * @brief Wakes senders still waiting with asio::error::operation_aborted and stops the write loop
+             */
+            ~SendQueue()
+            {
+                *alive = false;
+                for (auto* entry : pending_entries)
+                {
+                    Abort(*entry);
+                }
+                for (auto& flight : in_flight_entries)
+                {
+                    if (flight.entry)
+                    {
+                        Abort(*flight.entry);
+                    }
+                }
+                if (writing)
+                {
+                    //the write holds in_flight, which is about to be freed
+                    write_signal.emit(asio::cancellation_type::terminal);
+                }
+            }
+
+            /**
+             * @brief Set the queue options
+             *
+             * @param opts The options
+             */
+            void SetOptions(const SendQueueOptions& opts)
+            {
+                options = opts;
+            }
+
+            /**
+             * @brief Get the queue options
+             *
+             * @return The options
+             */
+            const SendQueueOptions& GetOptions() const
+            {
+                return options;
+            }
+
+            /**
+             * @brief Queue data and wait until it has been written
+             *
+             * @tparam Protocol The protocol implementation type
+             * @tparam Socket The socket type
+             * @tparam ConstBufferSequence The buffer sequence type
+             * @param impl The protocol implementation to write with, must outlive the queue
+             * @param socket The socket, must outlive the queue
+             * @param data The data to send. Must stay valid until the returned awaitable completes
+             * @param timeout How long the send may take, zero for none. A send still queued when it expires is
+             * dropped from the queue. One being written cancels just that write, failing the other sends it covers
+             * @return The number of bytes of data written and the first error to occur if there was one.
+             * Framing protocols return asio::error::message_size for data larger than their max frame size,
+             * asio::error::timed_out is returned if the timeout passed and asio::error::operation_aborted if
+             * the send was cancelled
+             */
+            template<class Protocol, class Socket, class ConstBufferSequence>
+            asio::awaitable<std::pair<std::size_t, error_code>> Send(Protocol& impl, Socket& socket, const ConstBufferSequence& data,
+                std::chrono::steady_clock::duration timeout = std::chrono::steady_clock::duration::zero())
+            {
+                executor = co_await asio::this_coro::executor;
+                Entry entry{ executor };
+                entry.deadline = timeout.count() > 0 ? std::chrono::steady_clock::now() + timeout : std::chrono::steady_clock::time_point::max();
+                entry.first = pending_buffers.size();
+                if constexpr (framing_protocol<Protocol>)
+                {
+                    //the peer would reject the frame, and sizes the prefix cannot hold would be cut short
+                    const std::size_t size = asio::buffer_size(data);
+                    entry.header_size = size <= impl.GetMaxFrameSize() ? Protocol::EncodeHeader(size, entry.header.data()) : 0;
+                    if (entry.header_size == 0)
+                    {
+                        co_return std::make_pair(std::size_t{ 0 }, error_code{ asio::error::message_size });
+                    }
+                    pending_buffers.push_back(asio::buffer(entry.header.data(), entry.header_size));
+                    entry.bytes += entry.header_size;
+                }
+                for (auto it = asio::buffer_sequence_begin(data); it != asio::buffer_sequence_end(data); ++it)
+                {
+                    asio::const_buffer buffer{ *it };
+                    pending_buffers.push_back(buffer);
+                    entry.bytes += buffer.size();
+                }
+                entry.count = pending_buffers.size() - entry.first;
+                entry.queue = this;
+                pending_entries.push_back(&entry);
+                pending_bytes += entry.bytes;
+
+                if (!writing)
+                {
+                    writing = true;
+                    if (options.cork.count() > 0 && !IsFull())
+                    {
+                        Cork(impl, socket);
+                    }
+                    else
+                    {
+                        Flush(impl, socket);
+                    }
+                }
+                else if (cork_timer && IsFull())
+                {
+                    cork_timer->cancel();
+                }
+
+                //an entry still being written must wait for its write even once cancelled, the write holds its buffers
+                const bool throws = co_await asio::this_coro::throw_if_cancelled();
+                co_await asio::this_coro::throw_if_cancelled(false);
+
+                //woken by Complete once a write covering this entry has finished, by the deadline or by cancellation
+                error_code ec{};
+                entry.timer.expires_at(entry.deadline);
+                while (!entry.done)
+                {
+                    co_await entry.timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                    if (entry.done)
+                    {
+                        break;
+                    }
+
+                    if (!ec)
+                    {
+                        Drop(entry, asio::error::timed_out);
+                    }
+                    else if (ec == asio::error::operation_aborted)
+                    {
+                        Drop(entry, asio::error::operation_aborted);
+                    }
+                }
+
+                co_await asio::this_coro::throw_if_cancelled(throws);
+                co_return entry.result;
+            }
+
+        private:
+            /**
+             * @struct Entry
+             * @brief A queued send, owned by the coroutine frame of the Send call that made it
+             */
+            struct Entry
+            {
+                explicit Entry(const asio::any_io_executor& exec) :
+                    timer(exec)
+                {
+
+                }
+
+                Entry(const Entry&) = delete;
+
+                Entry& operator=(const Entry&) = delete;
+
+                /**
+                 * @brief Unlinks the entry if its frame is destroyed while it is still queued
+                 */
+                ~Entry()
+                {
+                    if (queue && !done)
+                    {
+                        queue->Forget(*this);
+                    }
+                }
+
+                //! Wakes the sender once its data has been written, at the deadline or when cancelled
+                asio::steady_timer timer;
+
+                //! When the send times out
+                std::chrono::steady_clock::time_point deadline;
+
+                //! The queue holding the entry, null once the queue is gone
+                SendQueue* queue = nullptr;
+
+                //! The index of the entry's first buffer in pending_buffers
+                std::size_t first = 0;
+
+                //! The number of buffers the entry has in pending_buffers
+                std::size_t count = 0;
+
+                //! The total size of the entry's buffers
+                std::size_t bytes = 0;
+
+                //! The result reported to the sender
+                std::pair<std::size_t, error_code> result{};
+
+                //! Set once the result is ready
+                bool done = false;
+
+                //! Why the entry was dropped while being written, asio::error::timed_out or asio::error::operation_aborted
+                error_code dropped{};
+
+                //! Storage for the message header of framing protocols
+                std::array<char, 16> header{};
+
+                //! The size of the message header, not counted in the result
+                std::size_t header_size = 0;
+            };
+
+            /**
+             * @struct InFlight
+             * @brief An entry covered by the write in flight
+             */
+            struct InFlight
+            {
+                //! The entry, null if its sender's frame was destroyed during the write
+                Entry* entry = nullptr;
+
+                //! The size of the entry's buffers
+                std::size_t bytes = 0;
+            };
+
+            /**
+             * @brief Tells if enough is queued to flush without waiting for the cork timer
+             *
+             * @return True if a flush limit has been reached
+             */
+            bool IsFull() const
+            {
+                return pending_bytes >= options.max_bytes || pending_buffers.size() >= options.max_buffers;
+            }
+
+            /**
+             * @brief Remove a queued entry from pending_entries and pending_buffers
+             *
+             * @param it The entry's position in pending_entries
+             */
+            void Unlink(std::vector<Entry*>::iterator it)
+            {
+                Entry& entry = **it;
+                const auto first = pending_buffers.begin() + static_cast<std::ptrdiff_t>(entry.first);
+                pending_buffers.erase(first, first + static_cast<std::ptrdiff_t>(entry.count));
+                pending_bytes -= entry.bytes;
+                for (auto later = std::next(it); later != pending_entries.end(); ++later)
+                {
+                    (*later)->first -= entry.count;
+                }
+                pending_entries.erase(it);
+            }
+
+            /**
+             * @brief Handle an entry whose deadline passed or whose sender was cancelled. A queued entry is
+             * dropped, an entry being written cancels the write and is woken when it ends
+             *
+             * @param entry The entry
+             * @param reason The error reported to the sender
+             */
+            void Drop(Entry& entry, error_code reason)
+            {
+                entry.timer.expires_at(std::chrono::steady_clock::time_point::max());
+                if (entry.done || entry.dropped)
+                {
+                    return;
+                }
+
+                auto it = std::find(pending_entries.begin(), pending_entries.end(), &entry);
+                if (it == pending_entries.end())
+                {
+                    //only the write is cancelled, reads on the socket carry on
+                    entry.dropped = reason;
+                    write_signal.emit(asio::cancellation_type::terminal);
+                    return;
+                }
+
+                Unlink(it);
+                entry.result = std::make_pair(std::size_t{ 0 }, reason);
+                entry.done = true;
+            }
+
+            /**
+             * @brief Unlink an entry whose frame is being destroyed. If it is being written the write is
+             * cancelled, as it may cover the entry's header
+             *
+             * @param entry The entry
+             */
+            void Forget(Entry& entry)
+            {
+                if (auto it = std::find(pending_entries.begin(), pending_entries.end(), &entry); it != pending_entries.end())
+                {
+                    Unlink(it);
+                    return;
+                }
+
+                for (auto& flight : in_flight_entries)
+                {
+                    if (flight.entry == &entry)
+                    {
+                        flight.entry = nullptr;
+                        write_signal.emit(asio::cancellation_type::terminal);
+                    }
+                }
+            }
+
+            /**
+             * @brief Wake a waiting sender when the queue is destroyed
+             *
+             * @param entry The entry
+             */
+            void Abort(Entry& entry)
+            {
+                entry.queue = nullptr;
+                entry.result = std::make_pair(std::size_t{ 0 }, error_code{ asio::error::operation_aborted });
+                entry.done = true;
+                entry.timer.cancel();
+            }
+
+            /**
+             * @brief Hold the first write on an idle stream for the cork time, so later sends can join it.
+             * The timer is cancelled early once a flush limit is reached
+             *
+             * @tparam Protocol The protocol implementation type
+             * @tparam Socket The socket type
+             * @param impl The protocol implementation
+             * @param socket The socket
+             */
+            template<class Protocol, class Socket>
+            void Cork(Protocol& impl, Socket& socket)
+            {
+                if (!cork_timer)
+                {
+                    cork_timer.emplace(executor);
+                }
+                cork_timer->expires_after(options.cork);
+                cork_timer->async_wait(asio::bind_executor(executor, [this, alive = alive, &impl, &socket](const error_code&) {
+                    if (*alive)
+                    {
+                        Flush(impl, socket);
+                    }
+                }));
+            }
+
+            /**
+             * @brief Take queued entries, up to the flush limits, and start writing them. The write runs
+             * without a coroutine frame, its handler calls Complete and then writes the next batch, ending
+             * the write loop once the queue is empty
+             *
+             * @tparam Protocol The protocol implementation type
+             * @tparam Socket The socket type
+             * @param impl The protocol implementation
+             * @param socket The socket
+             */
+            template<class Protocol, class Socket>
+            void Flush(Protocol& impl, Socket& socket)
+            {
+                //every queued entry may have been dropped while corked
+                if (pending_entries.empty())
+                {
+                    writing = false;
+                    return;
+                }
+
+                //always take at least one entry so a single large send is not stuck
+                std::size_t entries = 0, buffers = 0, bytes = 0;
+                for (auto* entry : pending_entries)
+                {
+                    if (entries > 0 && (bytes + entry->bytes > options.max_bytes || buffers + entry->count > options.max_buffers))
+                    {
+                        break;
+                    }
+                    ++entries;
+                    buffers += entry->count;
+                    bytes += entry->bytes;
+                }
+
+                //later sends append to pending_buffers during the write, so write from a separate vector
+                in_flight.assign(pending_buffers.begin(), pending_buffers.begin() + buffers);
+                in_flight_entries.clear();
+                for (std::size_t i = 0; i < entries; ++i)
+                {
+                    in_flight_entries.push_back(InFlight{ pending_entries[i], pending_entries[i]->bytes });
+                }
+                pending_buffers.erase(pending_buffers.begin(), pending_buffers.begin() + buffers);
+                pending_entries.erase(pending_entries.begin(), pending_entries.begin() + entries);
+                pending_bytes -= bytes;
+                for (auto* entry : pending_entries)
+                {
+                    entry->first -= buffers;
+                }
+
+                //the write op copies its buffer sequence, a span saves copying the vector
+                in_flight_view = in_flight;
+                auto handler = asio::bind_cancellation_slot(write_signal.slot(), asio::bind_executor(executor,
+                    [this, alive = alive, &impl, &socket](const error_code& ec, std::size_t written) {
+                        if (!*alive)
+                        {
+                            return;
+                        }
+                        Complete(written, ec);
+                        Flush(impl, socket);
+                    }));
+                if constexpr (framing_protocol<Protocol>)
+                {
+                    //headers are already in the queued buffers
+                    static_cast<typename Protocol::base_type&>(impl).AsyncSend(socket, in_flight_view, std::move(handler));
+                }
+                else
+                {
+                    impl.AsyncSend(socket, in_flight_view, std::move(handler));
+                }
+            }
+
+            /**
+             * @brief Report the result of a write to the entries it covered and wake their senders
+             *
+             * @param written The number of bytes written
+             * @param ec The error from the write
+             */
+            void Complete(std::size_t written, error_code ec)
+            {
+                for (auto& flight : in_flight_entries)
+                {
+                    const std::size_t entry_written = std::min(written, flight.bytes);
+                    written -= entry_written;
+                    if (!flight.entry)
+                    {
+                        continue;
+                    }
+
+                    //entries fully written before an error still succeeded
+                    Entry& entry = *flight.entry;
+                    const std::size_t payload_written = entry_written > entry.header_size ? entry_written - entry.header_size : 0;
+                    entry.result = std::make_pair(payload_written, entry_written == entry.bytes ? error_code{} : ec);
+                    if (entry.dropped && entry.result.second)
+                    {
+                        entry.result.second = entry.dropped;
+                    }
+                    entry.done = true;
+                    entry.timer.cancel();
+                }
+                in_flight_entries.clear();
+            }
+
+            //! The queue options
+            SendQueueOptions options;
+
+            //! The executor senders run on, the write loop's handlers are bound to it
+            asio::any_io_executor executor;
+
+            //! Buffers of queued entries, in send order
+            std::vector<asio::const_buffer> pending_buffers;
+
+            //! Queued entries, in send order
+            std::vector<Entry*> pending_entries;
+
+            //! The total size of queued entries
+            std::size_t pending_bytes = 0;
+
+            //! Buffers of the write in flight
+            std::vector<asio::const_buffer> in_flight;
+
+            //! Views in_flight, outlives Flush so the write can hold it by reference
+            std::span<const asio::const_buffer> in_flight_view;
+
+            //! Entries covered by the write in flight
+            std::vector<InFlight> in_flight_entries;
+
+            //! Holds the first write on an idle stream for the cork time
+            std::optional<asio::steady_timer> cork_timer;
+
+            //! Cancels the write in flight when one of its entries times out or is cancelled
+            asio::cancellation_signal write_signal;
+
+            //! Cleared when the queue is destroyed, so completions already queued do not touch it
+            std::shared_ptr<bool> alive = std::make_shared<bool>(true);
+
+            //! True while the write loop runs
+            bool writing = false;
+        };
+    }
+}
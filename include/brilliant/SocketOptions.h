@@ -0,0 +1,169 @@
+/**
+ * @file SocketOptions.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines platform specific socket options and option structs used
+ * when creating acceptors and sockets
+ */
+
+#pragma once
+
+#include <chrono>
+
+#include "AsioIncludes.h"
+
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+#define BRILLIANT_NETWORK_HAS_REUSE_PORT
+#endif //SO_REUSEPORT
+
+#if !defined(_WIN32)
+#include <netinet/tcp.h>
+#if defined(TCP_FASTOPEN)
+#define BRILLIANT_NETWORK_HAS_TCP_FASTOPEN
+#endif //TCP_FASTOPEN
+#if defined(TCP_FASTOPEN_CONNECT)
+#define BRILLIANT_NETWORK_HAS_TCP_FASTOPEN_CONNECT
+#endif //TCP_FASTOPEN_CONNECT
+#endif //_WIN32
+
+namespace Brilliant
+{
+    namespace Network
+    {
+#ifdef BRILLIANT_NETWORK_HAS_REUSE_PORT
+        //! Socket option allowing several sockets to bind the same address and port. The kernel
+        //! load balances incoming connections and datagrams between them
+        using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif //BRILLIANT_NETWORK_HAS_REUSE_PORT
+
+#ifdef BRILLIANT_NETWORK_HAS_TCP_FASTOPEN
+        //! Socket option enabling tcp fast open on a listening socket. The value is the most
+        //! pending fast open connections, ones which have sent data but not finished the handshake
+        using tcp_fast_open = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_FASTOPEN>;
+#endif //BRILLIANT_NETWORK_HAS_TCP_FASTOPEN
+
+#ifdef BRILLIANT_NETWORK_HAS_TCP_FASTOPEN_CONNECT
+        //! Socket option making connect return at once so the first write is sent with the SYN,
+        //! if a fast open cookie for the server is cached. Falls back to a normal handshake otherwise
+        using tcp_fast_open_connect = asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_FASTOPEN_CONNECT>;
+#endif //BRILLIANT_NETWORK_HAS_TCP_FASTOPEN_CONNECT
+
+        /**
+         * @struct AcceptorOptions
+         * @brief Options applied by AwaitableServer when it opens a listening socket
+         */
+        struct AcceptorOptions
+        {
+            //! Bind with SO_REUSEPORT so one acceptor per thread can listen on the same service.
+            //! Ignored on platforms without SO_REUSEPORT
+            bool reuse_port = false;
+
+            //! The listen backlog
+            int backlog = asio::socket_base::max_listen_connections;
+
+            //! Accept tcp fast open connections, queueing at most this many which have not finished the
+            //! handshake. Zero disables fast open. Ignored on platforms without TCP_FASTOPEN
+            int fast_open_queue = 0;
+        };
+
+        /**
+         * @struct ConnectOptions
+         * @brief Options used when a connection connects to a host and service
+         */
+        struct ConnectOptions
+        {
+            //! Race connection attempts to the resolved addresses as in RFC 8305 (happy eyeballs),
+            //! alternating ipv6 and ipv4. When false the addresses are tried one after another
+            bool race = true;
+
+            //! How long an attempt runs on its own before the next address is tried alongside it
+            std::chrono::milliseconds attempt_delay = std::chrono::milliseconds(250);
+
+            //! Connect with tcp fast open, so the first Send after Connect (or the tls client hello)
+            //! rides the SYN once the server's cookie is cached. Only use when the first data is safe
+            //! to deliver twice. Ignored on platforms without TCP_FASTOPEN_CONNECT
+            bool fast_open = false;
+        };
+
+        /**
+         * @struct TimeoutOptions
+         * @brief The default deadlines of a connection's operations. Zero means no deadline
+         */
+        struct TimeoutOptions
+        {
+            //! Limit on connecting to a host and service, including the tls handshake. Resolving
+            //! is not interrupted, a deadline passed while resolving is reported once it finishes
+            std::chrono::steady_clock::duration connect{};
+
+            //! Limit on the server side tls handshake of an accepted connection
+            std::chrono::steady_clock::duration handshake{};
+
+            //! Limit on each Send
+            std::chrono::steady_clock::duration send{};
+
+            //! Limit on each read
+            std::chrono::steady_clock::duration read{};
+        };
+
+        /**
+         * @brief Apply the options which must be set before binding to a socket or acceptor
+         *
+         * @tparam Socket The socket or acceptor type
+         * @param socket An open socket or acceptor
+         * @param options The options to apply
+         * @param[out] ec An error_code that an error will be stored in if one occurs
+         */
+        template<class Socket>
+        void ApplyBindOptions([[maybe_unused]] Socket& socket, [[maybe_unused]] const AcceptorOptions& options, [[maybe_unused]] error_code& ec)
+        {
+#ifdef BRILLIANT_NETWORK_HAS_REUSE_PORT
+            if (options.reuse_port)
+            {
+                socket.set_option(reuse_port(true), ec);
+            }
+#endif //BRILLIANT_NETWORK_HAS_REUSE_PORT
+        }
+
+        /**
+         * @brief Apply the options which must be set before an acceptor starts listening
+         *
+         * @tparam Acceptor The acceptor type
+         * @param acceptor A bound acceptor
+         * @param options The options to apply
+         * @param[out] ec An error_code that an error will be stored in if one occurs
+         */
+        template<class Acceptor>
+        void ApplyListenOptions([[maybe_unused]] Acceptor& acceptor, [[maybe_unused]] const AcceptorOptions& options, [[maybe_unused]] error_code& ec)
+        {
+#ifdef BRILLIANT_NETWORK_HAS_TCP_FASTOPEN
+            if (options.fast_open_queue > 0)
+            {
+                acceptor.set_option(tcp_fast_open(options.fast_open_queue), ec);
+            }
+#endif //BRILLIANT_NETWORK_HAS_TCP_FASTOPEN
+        }
+
+        /**
+         * @brief Apply the options which must be set before a socket connects
+         *
+         * @tparam Socket The socket type
+         * @param socket An open socket
+         * @param options The options to apply
+         * @param[out] ec An error_code that an error will be stored in if one occurs
+         */
+        template<class Socket>
+        void ApplyConnectOptions([[maybe_unused]] Socket& socket, [[maybe_unused]] const ConnectOptions& options, [[maybe_unused]] error_code& ec)
+        {
+#ifdef BRILLIANT_NETWORK_HAS_TCP_FASTOPEN_CONNECT
+            if (options.fast_open)
+            {
+                socket.set_option(tcp_fast_open_connect(true), ec);
+            }
+#endif //BRILLIANT_NETWORK_HAS_TCP_FASTOPEN_CONNECT
+        }
+    }
+}
@@ -102,5 +102,22 @@ namespace Brilliant
             return boost::beast::get_lowest_layer(socket);
         }
 #endif
+
+        //abstraction for getting the asio socket at the bottom of a socket or stream
+        template<class Socket>
+        requires (!is_boost_beast_stream_v<Socket>)
+        auto& GetLowestSocket(Socket& socket)
+        {
+            return socket.lowest_layer();
+        }
+
+#ifdef BRILLIANT_NETWORK_HAS_BOOST_BEAST
+        template<class Socket>
+        requires (is_boost_beast_stream_v<Socket>)
+        auto& GetLowestSocket(Socket& socket)
+        {
+            return boost::beast::get_lowest_layer(socket).socket();
+        }
+#endif
     }
 }
\ No newline at end of file
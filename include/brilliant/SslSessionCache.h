@@ -0,0 +1,338 @@
+/**
+ * @file SslSessionCache.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the SslSessionCache class, a client side cache of tls sessions
+ * so reconnects to the same host resume instead of doing a full handshake
+ */
+
+#pragma once
+
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "AsioIncludes.h"
+#include "Ssl.h"
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @class SslSessionCache
+         * @brief Keeps the latest tls session per ssl context, host and service and offers it on the next
+         * connect. Sessions are stored from the ssl context's new session callback, so tls 1.3 tickets,
+         * which arrive after the handshake, are kept as well. The callback is set once per client context
+         * with Install, before the context is used. Safe to share between threads.
+         * The cache must outlive the connections using it
+         */
+        class SslSessionCache
+        {
+        public:
+            /**
+             * @brief Construct a new Ssl Session Cache object
+             *
+             * @param max_entries The most sessions kept. An arbitrary session is dropped to make room
+             */
+            explicit SslSessionCache(std::size_t max_entries = 1024) :
+                max_entries(max_entries)
+            {
+
+            }
+
+            SslSessionCache(const SslSessionCache&) = delete;
+            SslSessionCache& operator=(const SslSessionCache&) = delete;
+
+            /**
+             * @brief Destroy the Ssl Session Cache object and free the sessions it holds
+             *
+             */
+            ~SslSessionCache()
+            {
+                Clear();
+            }
+
+            /**
+             * @brief Get the cache shared by the whole process, used by the ssl protocols unless given another
+             *
+             * @return The shared cache
+             */
+            static SslSessionCache& Default()
+            {
+                static SslSessionCache cache;
+                return cache;
+            }
+
+            /**
+             * @brief Install the new session callback on a client context, so connections made with it
+             * store their sessions in the cache that offered for them. Sets client side caching without
+             * openssl's internal store, the caches hold the sessions. Call once while setting the context up,
+             * before any connection uses it. Replaces a new session callback already set
+             *
+             * @param ssl The client context
+             */
+            static void Install(asio::ssl::context& ssl)
+            {
+                SSL_CTX* ctx = ssl.native_handle();
+                SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+                SSL_CTX_sess_set_new_cb(ctx, &SslSessionCache::NewSession);
+            }
+
+            /**
+             * @brief Prepare a connection before its handshake. Offers the cached session for the host and
+             * service if there is a resumable one, and arranges for new sessions to be stored if Install was
+             * called on the connection's context. Does not change the context
+             *
+             * @param ssl The connection, ie asio::ssl::stream::native_handle()
+             * @param host The host connected to
+             * @param service The service connected to
+             * @return True if a session was offered
+             */
+            bool Offer(SSL* ssl, std::string_view host, std::string_view service)
+            {
+                SSL_CTX* ctx = SSL_get_SSL_CTX(ssl);
+                auto key = MakeKey(ctx, host, service);
+
+                if (SSL_CTX_sess_get_new_cb(ctx) == &SslSessionCache::NewSession)
+                {
+                    //a reconnect on the same stream replaces the tag of the last connect
+                    delete static_cast<Tag*>(SSL_get_ex_data(ssl, ExDataIndex()));
+                    SSL_set_ex_data(ssl, ExDataIndex(), new Tag{ this, key });
+                }
+
+                std::lock_guard lock(mutex);
+                auto it = sessions.find(key);
+                if (it == sessions.end()) { return false; }
+
+                if (!SSL_SESSION_is_resumable(it->second))
+                {
+                    SSL_SESSION_free(it->second);
+                    sessions.erase(it);
+                    return false;
+                }
+
+                return SSL_set_session(ssl, it->second) == 1;
+            }
+
+            /**
+             * @brief Count a finished handshake as a hit if it resumed a session, or a miss otherwise
+             *
+             * @param ssl The connection
+             * @param ec The handshake error. Failed handshakes drop the offered session and are not counted
+             */
+            void Complete(SSL* ssl, const error_code& ec)
+            {
+                auto* tag = static_cast<Tag*>(SSL_get_ex_data(ssl, ExDataIndex()));
+
+                std::lock_guard lock(mutex);
+                if (ec)
+                {
+                    //the server may have rejected the session, do not offer it again
+                    if (tag) { Erase(tag->key); }
+                    return;
+                }
+
+                SSL_session_reused(ssl) ? ++hits : ++misses;
+            }
+
+            /**
+             * @brief Drop the session for a host and service under every ssl context
+             *
+             * @param host The host
+             * @param service The service
+             */
+            void Invalidate(std::string_view host, std::string_view service)
+            {
+                const auto suffix = MakeKey(nullptr, host, service).substr(sizeof(SSL_CTX*));
+
+                std::lock_guard lock(mutex);
+                std::erase_if(sessions, [&suffix](const auto& item) {
+                    if (std::string_view{ item.first }.substr(sizeof(SSL_CTX*)) != suffix) { return false; }
+                    SSL_SESSION_free(item.second);
+                    return true;
+                });
+            }
+
+            /**
+             * @brief Drop every session
+             *
+             */
+            void Clear()
+            {
+                std::lock_guard lock(mutex);
+                for (auto& [key, session] : sessions)
+                {
+                    SSL_SESSION_free(session);
+                }
+                sessions.clear();
+            }
+
+            /**
+             * @brief Get the number of handshakes which resumed a session
+             *
+             * @return The number of hits
+             */
+            std::size_t Hits() const
+            {
+                std::lock_guard lock(mutex);
+                return hits;
+            }
+
+            /**
+             * @brief Get the number of handshakes which did not resume a session
+             *
+             * @return The number of misses
+             */
+            std::size_t Misses() const
+            {
+                std::lock_guard lock(mutex);
+                return misses;
+            }
+
+            /**
+             * @brief Get the number of sessions held
+             *
+             * @return The number of sessions
+             */
+            std::size_t Size() const
+            {
+                std::lock_guard lock(mutex);
+                return sessions.size();
+            }
+
+        private:
+            /**
+             * @struct Tag
+             * @brief Attached to a connection so the new session callback knows where to store its sessions
+             */
+            struct Tag
+            {
+                //! The cache to store in
+                SslSessionCache* cache;
+
+                //! The key to store under
+                std::string key;
+            };
+
+            /**
+             * @brief Store a session, replacing the previous one for the key
+             *
+             * @param key The key
+             * @param session The session, the cache takes the reference
+             */
+            void Store(const std::string& key, SSL_SESSION* session)
+            {
+                std::lock_guard lock(mutex);
+                auto it = sessions.find(key);
+                if (it != sessions.end())
+                {
+                    SSL_SESSION_free(it->second);
+                    it->second = session;
+                    return;
+                }
+
+                if (max_entries == 0)
+                {
+                    SSL_SESSION_free(session);
+                    return;
+                }
+
+                if (sessions.size() >= max_entries)
+                {
+                    Erase(sessions.begin()->first);
+                }
+                sessions.emplace(key, session);
+            }
+
+            /**
+             * @brief Drop the session for a key. The mutex must be held
+             *
+             * @param key The key
+             */
+            void Erase(const std::string& key)
+            {
+                auto it = sessions.find(key);
+                if (it == sessions.end()) { return; }
+
+                SSL_SESSION_free(it->second);
+                sessions.erase(it);
+            }
+
+            /**
+             * @brief The new session callback installed on ssl contexts. Called by openssl after a full
+             * handshake and for each tls 1.3 ticket
+             *
+             * @param ssl The connection
+             * @param session The new session
+             * @return 1 if the cache kept the session reference, 0 if openssl should free it
+             */
+            static int NewSession(SSL* ssl, SSL_SESSION* session)
+            {
+                auto* tag = static_cast<Tag*>(SSL_get_ex_data(ssl, ExDataIndex()));
+                if (!tag) { return 0; }
+
+                tag->cache->Store(tag->key, session);
+                return 1;
+            }
+
+            /**
+             * @brief Free the tag of a connection when openssl frees the connection
+             *
+             */
+            static void FreeTag(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+            {
+                delete static_cast<Tag*>(ptr);
+            }
+
+            /**
+             * @brief Get the ex data index used for tags
+             *
+             * @return The index
+             */
+            static int ExDataIndex()
+            {
+                static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, &SslSessionCache::FreeTag);
+                return index;
+            }
+
+            /**
+             * @brief Make the key of an ssl context, host and service
+             *
+             * @param ctx The ssl context, sessions only resume under the context which made them
+             * @param host The host
+             * @param service The service
+             * @return The key
+             */
+            static std::string MakeKey(const SSL_CTX* ctx, std::string_view host, std::string_view service)
+            {
+                std::string key(sizeof(ctx), '\0');
+                std::memcpy(key.data(), &ctx, sizeof(ctx));
+                key.append(host).push_back('\0');
+                key.append(service);
+                return key;
+            }
+
+            //! The most sessions kept
+            std::size_t max_entries;
+
+            //! Sessions by ssl context, host and service. Each holds a reference
+            std::unordered_map<std::string, SSL_SESSION*> sessions;
+
+            //! The number of resumed handshakes
+            std::size_t hits = 0;
+
+            //! The number of full handshakes
+            std::size_t misses = 0;
+
+            //! Guards everything above
+            mutable std::mutex mutex;
+        };
+    }
+}
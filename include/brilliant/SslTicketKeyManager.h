@@ -0,0 +1,570 @@
+/**
+ * @file SslTicketKeyManager.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines the SslTicketKeyManager class, which gives server ssl contexts
+ * rotating session ticket keys and a session cache that can be shared between
+ * servers, and between processes through exported keys
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AsioIncludes.h"
+#include "Ssl.h"
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif //OPENSSL_VERSION_NUMBER
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        /**
+         * @struct SslTicketKey
+         * @brief A session ticket key. Laid out as 80 bytes when exported: name, hmac key then aes key
+         */
+        struct SslTicketKey
+        {
+            //! Sent in the ticket so the server can find the key again
+            std::array<std::uint8_t, 16> name{};
+
+            //! The key authenticating the ticket
+            std::array<std::uint8_t, 32> hmac_key{};
+
+            //! The key encrypting the ticket
+            std::array<std::uint8_t, 32> aes_key{};
+
+            //! When the key started encrypting tickets
+            std::chrono::steady_clock::time_point created{};
+        };
+
+        /**
+         * @struct SslTicketKeyOptions
+         * @brief Rotation and cache limits of an SslTicketKeyManager
+         */
+        struct SslTicketKeyOptions
+        {
+            //! How often a new encryption key is made. Zero never rotates, for keys set with SetKeys
+            std::chrono::seconds rotation_interval = std::chrono::hours(1);
+
+            //! How many previous keys still decrypt tickets, which are then renewed with the current key
+            std::size_t previous_keys = 2;
+
+            //! The most sessions kept in the session cache, used by clients resuming by session id
+            std::size_t max_sessions = 20480;
+
+            //! How long a session or ticket may be resumed
+            std::chrono::seconds session_timeout = std::chrono::hours(2);
+
+            //! Identifies the sessions of this service. Must match across every server sharing sessions
+            std::string session_id_context = "BrilliantNetwork";
+        };
+
+        /**
+         * @struct SslResumptionMetrics
+         * @brief Counters of an SslTicketKeyManager
+         */
+        struct SslResumptionMetrics
+        {
+            //! Tickets issued
+            std::size_t tickets_issued = 0;
+
+            //! Tickets decrypted with the current key
+            std::size_t ticket_resumptions = 0;
+
+            //! Tickets decrypted with a previous key and renewed
+            std::size_t ticket_renewals = 0;
+
+            //! Tickets with an unknown key name, ie made before the key expired or by another service
+            std::size_t tickets_rejected = 0;
+
+            //! Session id lookups found in the cache
+            std::size_t cache_hits = 0;
+
+            //! Session id lookups not in the cache
+            std::size_t cache_misses = 0;
+
+            //! Sessions stored in the cache
+            std::size_t cache_stores = 0;
+
+            //! Key rotations
+            std::size_t rotations = 0;
+        };
+
+        /**
+         * @class SslTicketKeyManager
+         * @brief Installed on server ssl contexts to encrypt session tickets with keys it rotates, and to
+         * keep sessions for clients resuming by id. Every context installed on one manager resumes the
+         * others' sessions, so acceptors on several threads or servers can share it. Processes share
+         * tickets by exporting the keys from one manager and setting them on the others. Safe to share
+         * between threads. The manager must outlive the contexts it is installed on
+         */
+        class SslTicketKeyManager
+        {
+        public:
+            //! The size of an exported key
+            static constexpr std::size_t exported_key_size = 80;
+
+            /**
+             * @brief Construct a new Ssl Ticket Key Manager object with a fresh random key
+             *
+             * @param options Rotation and cache limits
+             */
+            explicit SslTicketKeyManager(SslTicketKeyOptions options = {}) :
+                options(std::move(options))
+            {
+                //room for the rotations to come, so growing never frees a buffer with keys in it
+                keys.reserve(this->options.previous_keys + 2);
+                MakeKey(keys.emplace_back());
+            }
+
+            SslTicketKeyManager(const SslTicketKeyManager&) = delete;
+            SslTicketKeyManager& operator=(const SslTicketKeyManager&) = delete;
+
+            /**
+             * @brief Destroy the Ssl Ticket Key Manager object, wiping its keys
+             *
+             */
+            ~SslTicketKeyManager()
+            {
+                Cleanse(keys.begin(), keys.end());
+            }
+
+            /**
+             * @brief Install the ticket key callback and the session cache on a server context
+             *
+             * @param ssl The server context
+             * @param[out] ec Set if openssl rejected a setting
+             */
+            void Install(asio::ssl::context& ssl, error_code& ec)
+            {
+                ec = {};
+                SSL_CTX* ctx = ssl.native_handle();
+
+                const auto& id_context = options.session_id_context;
+                if (SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>(id_context.data()), static_cast<unsigned int>(std::min<std::size_t>(id_context.size(), SSL_MAX_SID_CTX_LENGTH))) != 1 ||
+                    SSL_CTX_set_ex_data(ctx, ExDataIndex(), this) != 1)
+                {
+                    ec = asio::error::invalid_argument;
+                    return;
+                }
+
+                SSL_CTX_set_timeout(ctx, static_cast<long>(options.session_timeout.count()));
+                SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+                SSL_CTX_sess_set_new_cb(ctx, &SslTicketKeyManager::NewSession);
+                SSL_CTX_sess_set_get_cb(ctx, &SslTicketKeyManager::GetSession);
+                SSL_CTX_sess_set_remove_cb(ctx, &SslTicketKeyManager::RemoveSession);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &SslTicketKeyManager::TicketKey);
+#else
+                SSL_CTX_set_tlsext_ticket_key_cb(ctx, &SslTicketKeyManager::TicketKey);
+#endif //OPENSSL_VERSION_NUMBER
+            }
+
+            /**
+             * @brief Make a new encryption key now. The previous one keeps decrypting
+             *
+             */
+            void Rotate()
+            {
+                std::lock_guard lock(mutex);
+                RotateLocked();
+            }
+
+            /**
+             * @brief Replace the keys, ie with keys exported by another process
+             *
+             * @param exported Keys as written by ExportKeys, the first encrypts and the rest only decrypt
+             * @param[out] ec Set if the keys were not a whole number of exported keys, in which case nothing changes
+             */
+            void SetKeys(std::span<const std::uint8_t> exported, error_code& ec)
+            {
+                ec = {};
+                if (exported.empty() || exported.size() % exported_key_size != 0)
+                {
+                    ec = asio::error::invalid_argument;
+                    return;
+                }
+
+                //filled in place, with room for the next rotation, so no copy of a key is left behind
+                std::vector<SslTicketKey> imported;
+                imported.reserve(exported.size() / exported_key_size + 1);
+                const auto now = std::chrono::steady_clock::now();
+                for (std::size_t offset = 0; offset < exported.size(); offset += exported_key_size)
+                {
+                    auto& key = imported.emplace_back();
+                    const auto* data = exported.data() + offset;
+                    std::memcpy(key.name.data(), data, key.name.size());
+                    std::memcpy(key.hmac_key.data(), data + 16, key.hmac_key.size());
+                    std::memcpy(key.aes_key.data(), data + 48, key.aes_key.size());
+                    key.created = now;
+                }
+
+                std::lock_guard lock(mutex);
+                Cleanse(keys.begin(), keys.end());
+                keys = std::move(imported);
+            }
+
+            /**
+             * @brief Export the keys for another process, current key first
+             *
+             * @return The keys, exported_key_size bytes each
+             */
+            std::vector<std::uint8_t> ExportKeys() const
+            {
+                std::lock_guard lock(mutex);
+                std::vector<std::uint8_t> exported;
+                exported.reserve(keys.size() * exported_key_size);
+                for (const auto& key : keys)
+                {
+                    exported.insert(exported.end(), key.name.begin(), key.name.end());
+                    exported.insert(exported.end(), key.hmac_key.begin(), key.hmac_key.end());
+                    exported.insert(exported.end(), key.aes_key.begin(), key.aes_key.end());
+                }
+                return exported;
+            }
+
+            /**
+             * @brief Get a snapshot of the counters
+             *
+             * @return The counters
+             */
+            SslResumptionMetrics GetMetrics() const
+            {
+                std::lock_guard lock(mutex);
+                return metrics;
+            }
+
+            /**
+             * @brief Get the number of sessions in the session cache
+             *
+             * @return The number of sessions
+             */
+            std::size_t SessionCount() const
+            {
+                std::lock_guard lock(mutex);
+                return sessions.size();
+            }
+
+        private:
+            /**
+             * @struct StoredSession
+             * @brief A serialized session in the cache
+             */
+            struct StoredSession
+            {
+                //! The session as written by i2d_SSL_SESSION
+                std::vector<unsigned char> der;
+
+                //! When the session can no longer be resumed
+                std::chrono::steady_clock::time_point expires;
+            };
+
+            /**
+             * @brief Fill a key with random bytes, in place so no copy of it is left on the stack
+             *
+             * @param key The key
+             */
+            static void MakeKey(SslTicketKey& key)
+            {
+                RAND_bytes(key.name.data(), static_cast<int>(key.name.size()));
+                RAND_bytes(key.hmac_key.data(), static_cast<int>(key.hmac_key.size()));
+                RAND_bytes(key.aes_key.data(), static_cast<int>(key.aes_key.size()));
+                key.created = std::chrono::steady_clock::now();
+            }
+
+            /**
+             * @brief Make a new encryption key and drop keys past the previous key limit. The mutex must be held
+             *
+             */
+            void RotateLocked()
+            {
+                if (keys.size() == keys.capacity())
+                {
+                    //grown by hand so the old buffer is wiped rather than freed with keys in it
+                    std::vector<SslTicketKey> grown;
+                    grown.reserve(std::max(keys.size(), options.previous_keys + 1) + 1);
+                    grown.assign(keys.begin(), keys.end());
+                    Cleanse(keys.begin(), keys.end());
+                    keys.swap(grown);
+                }
+
+                //within capacity the keys shift up in place
+                MakeKey(*keys.emplace(keys.begin()));
+                if (keys.size() > options.previous_keys + 1)
+                {
+                    Cleanse(keys.begin() + options.previous_keys + 1, keys.end());
+                    keys.resize(options.previous_keys + 1);
+                }
+                ++metrics.rotations;
+            }
+
+            /**
+             * @brief Wipe the secret parts of keys about to be dropped
+             *
+             * @tparam Iterator The key iterator type
+             * @param first The first key
+             * @param last One past the last key
+             */
+            template<class Iterator>
+            static void Cleanse(Iterator first, Iterator last)
+            {
+                for (; first != last; ++first)
+                {
+                    OPENSSL_cleanse(first->name.data(), first->name.size());
+                    OPENSSL_cleanse(first->hmac_key.data(), first->hmac_key.size());
+                    OPENSSL_cleanse(first->aes_key.data(), first->aes_key.size());
+                }
+            }
+
+            /**
+             * @brief Get the manager installed on the context of a connection
+             *
+             * @param ctx The context
+             * @return The manager, or null
+             */
+            static SslTicketKeyManager* FromContext(SSL_CTX* ctx)
+            {
+                return static_cast<SslTicketKeyManager*>(SSL_CTX_get_ex_data(ctx, ExDataIndex()));
+            }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            using mac_context_type = EVP_MAC_CTX;
+#else
+            using mac_context_type = HMAC_CTX;
+#endif //OPENSSL_VERSION_NUMBER
+
+            /**
+             * @brief Set up the cipher and mac of a ticket
+             *
+             * @param key The key
+             * @param iv The ticket iv
+             * @param cipher The cipher context
+             * @param mac The mac context
+             * @param encrypt If the ticket is being encrypted
+             * @return True on success
+             */
+            static bool InitTicket(const SslTicketKey& key, unsigned char* iv, EVP_CIPHER_CTX* cipher, mac_context_type* mac, bool encrypt)
+            {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                char digest[] = "SHA256";
+                OSSL_PARAM params[] = {
+                    OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<std::uint8_t*>(key.hmac_key.data()), key.hmac_key.size()),
+                    OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+                    OSSL_PARAM_construct_end()
+                };
+                if (EVP_MAC_CTX_set_params(mac, params) != 1) { return false; }
+#else
+                if (HMAC_Init_ex(mac, key.hmac_key.data(), static_cast<int>(key.hmac_key.size()), EVP_sha256(), nullptr) != 1) { return false; }
+#endif //OPENSSL_VERSION_NUMBER
+
+                return encrypt ?
+                    EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv) == 1 :
+                    EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv) == 1;
+            }
+
+            /**
+             * @brief The ticket key callback. Encrypts with the current key, rotating it first if it is due,
+             * and decrypts with any key still kept
+             *
+             * @return For encryption 1 on success. For decryption 1 to accept, 2 to accept and renew the
+             * ticket, 0 for an unknown key. -1 on error
+             */
+            static int TicketKey(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher, mac_context_type* mac, int encrypt)
+            {
+                auto* self = FromContext(SSL_get_SSL_CTX(ssl));
+                if (!self) { return -1; }
+
+                std::lock_guard lock(self->mutex);
+                if (encrypt)
+                {
+                    const auto interval = self->options.rotation_interval;
+                    if (interval.count() > 0 && std::chrono::steady_clock::now() - self->keys.front().created >= interval)
+                    {
+                        self->RotateLocked();
+                    }
+
+                    const auto& key = self->keys.front();
+                    if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) { return -1; }
+                    std::memcpy(key_name, key.name.data(), key.name.size());
+                    if (!InitTicket(key, iv, cipher, mac, true)) { return -1; }
+
+                    //the client resumes from the ticket, NewSession has nothing to keep
+                    SSL_set_ex_data(ssl, TicketIssuedIndex(), self);
+
+                    ++self->metrics.tickets_issued;
+                    return 1;
+                }
+
+                auto it = std::find_if(self->keys.begin(), self->keys.end(), [key_name](const SslTicketKey& key) {
+                    return std::memcmp(key.name.data(), key_name, key.name.size()) == 0;
+                });
+                if (it == self->keys.end())
+                {
+                    ++self->metrics.tickets_rejected;
+                    return 0;
+                }
+
+                if (!InitTicket(*it, iv, cipher, mac, false)) { return -1; }
+
+                if (it == self->keys.begin())
+                {
+                    ++self->metrics.ticket_resumptions;
+                    return 1;
+                }
+
+                ++self->metrics.ticket_renewals;
+                return 2;
+            }
+
+            /**
+             * @brief Store a new session in the cache. Skipped once a ticket was issued on the connection,
+             * which covers tls 1.2 ticket sessions and stateless tls 1.3 sessions. Clients resume those from
+             * the ticket, only sessions without one are resumed by id
+             *
+             * @return 0, the cache keeps a copy rather than the reference
+             */
+            static int NewSession(SSL* ssl, SSL_SESSION* session)
+            {
+                auto* self = FromContext(SSL_get_SSL_CTX(ssl));
+                if (!self || SSL_get_ex_data(ssl, TicketIssuedIndex())) { return 0; }
+
+                unsigned int id_length = 0;
+                const unsigned char* id = SSL_SESSION_get_id(session, &id_length);
+                const int size = i2d_SSL_SESSION(session, nullptr);
+                if (size <= 0) { return 0; }
+
+                StoredSession stored{ std::vector<unsigned char>(static_cast<std::size_t>(size)), {} };
+                unsigned char* out = stored.der.data();
+                i2d_SSL_SESSION(session, &out);
+
+                std::lock_guard lock(self->mutex);
+                stored.expires = std::chrono::steady_clock::now() + self->options.session_timeout;
+                self->MakeRoom();
+                self->sessions.insert_or_assign(std::string(reinterpret_cast<const char*>(id), id_length), std::move(stored));
+                ++self->metrics.cache_stores;
+                return 0;
+            }
+
+            /**
+             * @brief Look up a session by id for a client resuming without a ticket
+             *
+             * @return A new session the caller owns, or null
+             */
+            static SSL_SESSION* GetSession(SSL* ssl, const unsigned char* id, int id_length, int* copy)
+            {
+                *copy = 0;
+                auto* self = FromContext(SSL_get_SSL_CTX(ssl));
+                if (!self) { return nullptr; }
+
+                std::vector<unsigned char> der;
+                {
+                    std::lock_guard lock(self->mutex);
+                    auto it = self->sessions.find(std::string(reinterpret_cast<const char*>(id), static_cast<std::size_t>(id_length)));
+                    if (it == self->sessions.end() || it->second.expires <= std::chrono::steady_clock::now())
+                    {
+                        if (it != self->sessions.end()) { self->sessions.erase(it); }
+                        ++self->metrics.cache_misses;
+                        return nullptr;
+                    }
+
+                    ++self->metrics.cache_hits;
+                    der = it->second.der;
+                }
+
+                const unsigned char* in = der.data();
+                return d2i_SSL_SESSION(nullptr, &in, static_cast<long>(der.size()));
+            }
+
+            /**
+             * @brief Drop a session openssl no longer wants resumed
+             *
+             */
+            static void RemoveSession(SSL_CTX* ctx, SSL_SESSION* session)
+            {
+                auto* self = FromContext(ctx);
+                if (!self) { return; }
+
+                unsigned int id_length = 0;
+                const unsigned char* id = SSL_SESSION_get_id(session, &id_length);
+
+                std::lock_guard lock(self->mutex);
+                self->sessions.erase(std::string(reinterpret_cast<const char*>(id), id_length));
+            }
+
+            /**
+             * @brief Make room for a session if the cache is full. Drops expired sessions, then any session.
+             * The mutex must be held
+             *
+             */
+            void MakeRoom()
+            {
+                if (sessions.size() < options.max_sessions) { return; }
+
+                const auto now = std::chrono::steady_clock::now();
+                std::erase_if(sessions, [now](const auto& item) { return item.second.expires <= now; });
+                while (!sessions.empty() && sessions.size() >= options.max_sessions)
+                {
+                    sessions.erase(sessions.begin());
+                }
+            }
+
+            /**
+             * @brief Get the ex data index the manager is stored under on contexts
+             *
+             * @return The index
+             */
+            static int ExDataIndex()
+            {
+                static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+                return index;
+            }
+
+            /**
+             * @brief Get the ex data index marking connections a ticket was issued on
+             *
+             * @return The index
+             */
+            static int TicketIssuedIndex()
+            {
+                static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+                return index;
+            }
+
+            //! Rotation and cache limits
+            SslTicketKeyOptions options;
+
+            //! The keys, the current encryption key first
+            std::vector<SslTicketKey> keys;
+
+            //! Sessions by id
+            std::unordered_map<std::string, StoredSession> sessions;
+
+            //! The counters
+            SslResumptionMetrics metrics;
+
+            //! Guards everything above
+            mutable std::mutex mutex;
+        };
+    }
+}
@@ -0,0 +1,221 @@
+/**
+ * @file UdpOffload.h
+ * @author David Brill (6david6brill6@gmail.com)
+ *
+ * @copyright Copyright (c) 2023
+ * Distributed under the Apache License 2.0 (see accompanying
+ * file LICENSE or copy at http://www.apache.org/licenses/)
+ *
+ * @brief Defines udp segmentation offload (GSO) and receive coalescing (GRO)
+ * helpers. Only available on linux, see BRILLIANT_NETWORK_HAS_UDP_GSO
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "AsioIncludes.h"
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define BRILLIANT_NETWORK_HAS_UDP_GSO
+#endif //UDP_SEGMENT && UDP_GRO
+#endif //__linux__
+
+namespace Brilliant
+{
+    namespace Network
+    {
+        //! The most segments the kernel accepts in one segmented send
+        inline constexpr std::size_t max_gso_segments = 64;
+
+        //! The most payload bytes the kernel accepts in one segmented send
+        inline constexpr std::size_t max_gso_bytes = 65000;
+
+        //! The most buffers SendSegmented gathers in one send
+        inline constexpr std::size_t max_gso_iovecs = 64;
+
+        /**
+         * @brief Split a coalesced buffer into equal sized segments. The last segment may be shorter
+         *
+         * @param data The coalesced data
+         * @param segment_size The segment size. Zero treats data as one segment
+         * @param[out] segments Receives the segments
+         * @return The number of segments written, at most segments.size()
+         */
+        inline std::size_t SplitSegments(asio::const_buffer data, std::size_t segment_size, std::span<asio::const_buffer> segments)
+        {
+            if (segment_size == 0) { segment_size = data.size(); }
+
+            std::size_t count = 0;
+            while (data.size() > 0 && count < segments.size())
+            {
+                const std::size_t size = std::min(segment_size, data.size());
+                segments[count++] = asio::const_buffer{ data.data(), size };
+                data += size;
+            }
+            return count;
+        }
+
+        /**
+         * @brief Get a byte range of a buffer sequence without copying
+         *
+         * @param buffers The buffers
+         * @param offset The offset of the first byte
+         * @param size The number of bytes
+         * @param[out] out Cleared, then filled with buffers covering the range
+         */
+        inline void SliceBuffers(std::span<const asio::const_buffer> buffers, std::size_t offset, std::size_t size, std::vector<asio::const_buffer>& out)
+        {
+            out.clear();
+            for (auto buffer : buffers)
+            {
+                if (size == 0) { break; }
+                if (offset >= buffer.size())
+                {
+                    offset -= buffer.size();
+                    continue;
+                }
+
+                buffer += offset;
+                offset = 0;
+                const std::size_t n = std::min(size, buffer.size());
+                out.emplace_back(buffer.data(), n);
+                size -= n;
+            }
+        }
+
+#ifdef BRILLIANT_NETWORK_HAS_UDP_GSO
+        //! Socket option enabling receive coalescing of datagrams from the same flow
+        using udp_gro = asio::detail::socket_option::boolean<SOL_UDP, UDP_GRO>;
+
+        /**
+         * @brief Send data as equal sized datagrams with a single system call, without blocking
+         *
+         * @tparam Socket The udp socket type
+         * @tparam Endpoint The endpoint type
+         * @tparam ConstBufferSequence The buffer sequence type, at most max_gso_iovecs buffers
+         * @param socket The socket
+         * @param destination The destination, null on a connected socket
+         * @param data The data to send. Split into datagrams of segment_size bytes, the last may be shorter
+         * @param segment_size The datagram payload size
+         * @param[out] ec Set to asio::error::would_block if the socket is not writable, or to any other error
+         * @return The number of bytes sent
+         */
+        template<class Socket, class Endpoint, class ConstBufferSequence>
+        std::size_t SendSegmented(Socket& socket, const Endpoint* destination, const ConstBufferSequence& data, std::uint16_t segment_size, error_code& ec)
+        {
+            ec = {};
+            std::array<iovec, max_gso_iovecs> iovecs{};
+            std::size_t count = 0;
+            for (auto it = asio::buffer_sequence_begin(data); it != asio::buffer_sequence_end(data); ++it)
+            {
+                if (count == iovecs.size())
+                {
+                    ec = asio::error::invalid_argument;
+                    return 0;
+                }
+
+                asio::const_buffer buffer{ *it };
+                iovecs[count++] = iovec{ const_cast<void*>(buffer.data()), buffer.size() };
+            }
+
+            alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(std::uint16_t))> control{};
+            msghdr message{};
+            message.msg_iov = iovecs.data();
+            message.msg_iovlen = count;
+            if (destination)
+            {
+                message.msg_name = const_cast<void*>(static_cast<const void*>(destination->data()));
+                message.msg_namelen = static_cast<socklen_t>(destination->size());
+            }
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+
+            cmsghdr* header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_UDP;
+            header->cmsg_type = UDP_SEGMENT;
+            header->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+            std::memcpy(CMSG_DATA(header), &segment_size, sizeof(segment_size));
+
+            const auto result = ::sendmsg(socket.native_handle(), &message, MSG_DONTWAIT);
+            if (result < 0)
+            {
+                ec = (errno == EAGAIN || errno == EWOULDBLOCK) ? error_code{ asio::error::would_block } : error_code{ errno, asio::error::get_system_category() };
+                return 0;
+            }
+            return static_cast<std::size_t>(result);
+        }
+
+        /**
+         * @brief Receive a datagram, or a coalesced run of datagrams if GRO is enabled, without blocking
+         *
+         * @tparam Socket The udp socket type
+         * @tparam Endpoint The endpoint type
+         * @param socket The socket
+         * @param source Receives the source endpoint, may be null
+         * @param data The buffer to receive into
+         * @param[out] segment_size The size of each coalesced datagram, or the received size if nothing was coalesced
+         * @param[out] ec Set to asio::error::would_block if nothing was available, asio::error::message_size if
+         * the datagrams did not fit in data and were cut short, or to any other error
+         * @return The number of bytes received
+         */
+        template<class Socket, class Endpoint>
+        std::size_t ReceiveCoalesced(Socket& socket, Endpoint* source, asio::mutable_buffer data, std::size_t& segment_size, error_code& ec)
+        {
+            ec = {};
+            iovec vec{ data.data(), data.size() };
+
+            alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+            msghdr message{};
+            message.msg_iov = &vec;
+            message.msg_iovlen = 1;
+            if (source)
+            {
+                message.msg_name = source->data();
+                message.msg_namelen = static_cast<socklen_t>(source->capacity());
+            }
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+
+            const auto result = ::recvmsg(socket.native_handle(), &message, MSG_DONTWAIT);
+            if (result < 0)
+            {
+                ec = (errno == EAGAIN || errno == EWOULDBLOCK) ? error_code{ asio::error::would_block } : error_code{ errno, asio::error::get_system_category() };
+                return 0;
+            }
+
+            if (source)
+            {
+                source->resize(message.msg_namelen);
+            }
+
+            segment_size = static_cast<std::size_t>(result);
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level == SOL_UDP && header->cmsg_type == UDP_GRO)
+                {
+                    int size{};
+                    std::memcpy(&size, CMSG_DATA(header), sizeof(size));
+                    segment_size = static_cast<std::size_t>(size);
+                }
+            }
+
+            if (message.msg_flags & MSG_TRUNC)
+            {
+                ec = asio::error::message_size;
+            }
+            return static_cast<std::size_t>(result);
+        }
+#endif //BRILLIANT_NETWORK_HAS_UDP_GSO
+    }
+}